@@ -0,0 +1,45 @@
+#ifndef ACTIVE_DOMAIN_H
+#define ACTIVE_DOMAIN_H
+
+#include "./matrix.hpp"
+#include "./vector.hpp"
+#include "./globals.hpp"
+
+/**
+ * @brief Compact index of the active (foreground) pixels of a frame
+ *
+ * Unknowns are stored only for active pixels, in row-major order.
+ * Neighbour tables give the compact index of the pixel below / to the
+ * right, or -1 when that neighbour is outside the frame or the mask.
+ */
+struct ActiveDomain
+{
+    int rows, cols;            // full frame dimensions
+    int num_active;            // number of active pixels
+
+    Vector<int> row, col;      // frame position (0-based) of each active pixel
+    Vector<int> down, right;   // neighbour tables
+    Vector<int> index;         // frame pixel (row-major) → compact index, or -1
+};
+
+// Problem data for the masked solvers
+struct MaskedData
+{
+    const ActiveDomain* domain;
+    Vector<double> values;     // intensities (first stage) or p then q (height stage)
+    EnergyWeights weights;
+};
+
+ActiveDomain buildActiveDomain(const Matrix& mask);             // mask != 0 is active
+Matrix backgroundMask(const Matrix& image, double background);  // 1 where image != background
+
+Vector<double> gatherFromFrame(const Matrix& M, const ActiveDomain& domain);
+Matrix scatterToFrame(const Vector<double>& v, const ActiveDomain& domain, double fill);
+
+double maskedObjective(const Vector<double>& x, const MaskedData& data);
+Vector<double> maskedGradient(const Vector<double>& x, const MaskedData& data);
+
+double maskedHeightObjective(const Vector<double>& h, const MaskedData& data);
+Vector<double> maskedHeightGradient(const Vector<double>& h, const MaskedData& data);
+
+#endif // ACTIVE_DOMAIN_H
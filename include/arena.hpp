@@ -0,0 +1,73 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+#include <vector>
+
+/**
+ * @brief Bump allocator for short-lived solver temporaries
+ *
+ * Memory is handed out from large chunks and only given back all at once
+ * (reset) or down to a previous mark (rewind). After a reset the chunks
+ * are merged into one, so once the workload has been seen a frame runs
+ * without touching the system allocator.
+ */
+class FrameArena
+{
+public:
+    struct Mark
+    {
+        size_t chunk;      // index of the current chunk
+        size_t used;       // bytes used in that chunk
+    };
+
+    explicit FrameArena(size_t chunk_bytes = 1 << 20);
+    ~FrameArena();
+
+    void* allocate(size_t bytes);    // 64-byte aligned block (throws std::bad_alloc)
+    Mark mark() const;               // current position
+    void rewind(const Mark& m);      // free everything allocated after m
+    void reset();                    // free everything, keep the memory
+
+    size_t bytesInUse() const;       // bytes currently handed out
+    size_t highWaterMark() const;    // peak of bytesInUse() since construction
+    size_t capacity() const;         // bytes reserved from the system
+    long systemAllocations() const;  // number of chunks ever obtained from the system
+
+private:
+    struct Chunk
+    {
+        char* data;
+        size_t size;
+        size_t used;
+    };
+
+    std::vector<Chunk> chunks;
+    size_t current;
+    size_t chunk_bytes;
+    size_t in_use;
+    size_t peak;
+    long system_allocations;
+
+    FrameArena(const FrameArena&);
+    FrameArena& operator=(const FrameArena&);
+};
+
+// Arena serving Matrix / Vector allocations on the calling thread (nullptr: heap)
+FrameArena* activeArena();
+
+/**
+ * @brief Routes Matrix / Vector allocations of the current thread to an
+ *        arena for the lifetime of the scope
+ */
+class ArenaScope
+{
+public:
+    explicit ArenaScope(FrameArena& arena);
+    ~ArenaScope();
+
+private:
+    FrameArena* previous;
+};
+
+#endif // ARENA_H
@@ -0,0 +1,250 @@
+#ifndef AUTODIFF_H
+#define AUTODIFF_H
+
+#include "./vector.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+/*
+ * Forward-mode automatic differentiation of per-pixel stencil energies.
+ *
+ * An energy term is written once, as a functor on the few unknowns its
+ * stencil reads around an anchor pixel:
+ *
+ *     struct Term
+ *     {
+ *         static constexpr int size = ...;             // unknowns read
+ *         static constexpr StencilTap taps[size] = {}; // which ones
+ *
+ *         template <typename T>
+ *         T operator()(const T* u, int i, int j) const; // energy at (i, j)
+ *     };
+ *
+ * u[k] is the unknown of field taps[k].field at pixel
+ * (i + taps[k].di, j + taps[k].dj); the term is summed over every anchor
+ * whose taps all lie in the frame. Called with T = double it is a plain
+ * objective; with T = Dual<size>, seeded with one unit derivative per
+ * tap, the same code also yields the derivatives of the term in its
+ * size unknowns, which are scattered into the gradient. Everything is
+ * inlined at compile time: there is no tape, and the cost per anchor is
+ * that of the term times size.
+ *
+ * Unknowns are stored field after field (p then q, ...), each field
+ * row-major.
+ */
+
+// Unknown read by a stencil: field at offset (di, dj) from the anchor
+struct StencilTap
+{
+    int field;
+    int di, dj;
+};
+
+// Value and derivatives in N variables
+template <int N>
+struct Dual
+{
+    double value;
+    double grad[N];
+
+    Dual() : value(0.0)
+    {
+        for (int k = 0; k < N; k++)
+            grad[k] = 0.0;
+    }
+
+    Dual(double constant) : value(constant)
+    {
+        for (int k = 0; k < N; k++)
+            grad[k] = 0.0;
+    }
+
+    // Variable number k of the stencil
+    static Dual variable(double value, int k)
+    {
+        Dual x(value);
+        x.grad[k] = 1.0;
+        return x;
+    }
+};
+
+// Chain rule: f(x) with f(x.value) = value and f'(x.value) = derivative
+template <int N>
+inline Dual<N> chain(const Dual<N>& x, double value, double derivative)
+{
+    Dual<N> result(value);
+    for (int k = 0; k < N; k++)
+        result.grad[k] = derivative * x.grad[k];
+    return result;
+}
+
+template <int N>
+inline Dual<N> operator+(const Dual<N>& a, const Dual<N>& b)
+{
+    Dual<N> result(a.value + b.value);
+    for (int k = 0; k < N; k++)
+        result.grad[k] = a.grad[k] + b.grad[k];
+    return result;
+}
+
+template <int N>
+inline Dual<N> operator-(const Dual<N>& a, const Dual<N>& b)
+{
+    Dual<N> result(a.value - b.value);
+    for (int k = 0; k < N; k++)
+        result.grad[k] = a.grad[k] - b.grad[k];
+    return result;
+}
+
+template <int N>
+inline Dual<N> operator*(const Dual<N>& a, const Dual<N>& b)
+{
+    Dual<N> result(a.value * b.value);
+    for (int k = 0; k < N; k++)
+        result.grad[k] = a.grad[k] * b.value + a.value * b.grad[k];
+    return result;
+}
+
+template <int N>
+inline Dual<N> operator/(const Dual<N>& a, const Dual<N>& b)
+{
+    Dual<N> result(a.value / b.value);
+    for (int k = 0; k < N; k++)
+        result.grad[k] = (a.grad[k] - result.value * b.grad[k]) / b.value;
+    return result;
+}
+
+template <int N>
+inline Dual<N> operator-(const Dual<N>& a)
+{
+    return chain(a, -a.value, -1.0);
+}
+
+// Mixed with constants
+template <int N> inline Dual<N> operator+(const Dual<N>& a, double b) { return chain(a, a.value + b, 1.0); }
+template <int N> inline Dual<N> operator+(double a, const Dual<N>& b) { return chain(b, a + b.value, 1.0); }
+template <int N> inline Dual<N> operator-(const Dual<N>& a, double b) { return chain(a, a.value - b, 1.0); }
+template <int N> inline Dual<N> operator-(double a, const Dual<N>& b) { return chain(b, a - b.value, -1.0); }
+template <int N> inline Dual<N> operator*(const Dual<N>& a, double b) { return chain(a, a.value * b, b); }
+template <int N> inline Dual<N> operator*(double a, const Dual<N>& b) { return chain(b, a * b.value, a); }
+template <int N> inline Dual<N> operator/(const Dual<N>& a, double b) { return chain(a, a.value / b, 1.0 / b); }
+
+template <int N>
+inline Dual<N> operator/(double a, const Dual<N>& b)
+{
+    double value = a / b.value;
+    return chain(b, value, -value / b.value);
+}
+
+// Elementary functions, for double and Dual alike
+inline double square(double x) { return x * x; }
+
+template <int N>
+inline Dual<N> square(const Dual<N>& x)
+{
+    return chain(x, x.value * x.value, 2.0 * x.value);
+}
+
+template <int N>
+inline Dual<N> sqrt(const Dual<N>& x)
+{
+    double root = std::sqrt(x.value);
+    return chain(x, root, 0.5 / root);
+}
+
+template <int N>
+inline Dual<N> exp(const Dual<N>& x)
+{
+    double e = std::exp(x.value);
+    return chain(x, e, e);
+}
+
+template <int N>
+inline Dual<N> log(const Dual<N>& x)
+{
+    return chain(x, std::log(x.value), 1.0 / x.value);
+}
+
+template <int N>
+inline Dual<N> pow(const Dual<N>& x, double exponent)
+{
+    double power = std::pow(x.value, exponent - 1.0);
+    return chain(x, power * x.value, exponent * power);
+}
+
+// Radiance of a reflectance model (see reflectance.hpp) at dual slopes,
+// through the derivatives its shade() already provides
+template <typename Model>
+inline double modelRadiance(const Model& model, double p, double q)
+{
+    return model.radiance(p, q);
+}
+
+template <typename Model, int N>
+inline Dual<N> modelRadiance(const Model& model, const Dual<N>& p, const Dual<N>& q)
+{
+    double R, R_p, R_q;
+    model.shade(p.value, q.value, R, R_p, R_q);
+
+    Dual<N> result(R);
+    for (int k = 0; k < N; k++)
+        result.grad[k] = R_p * p.grad[k] + R_q * q.grad[k];
+    return result;
+}
+
+// Sum of a term over the frame (rows x cols); with a gradient, the term's
+// derivatives are added to it
+template <typename Term>
+double stencilEnergy(const Term& term, const Vector<double>& x, int rows, int cols,
+                     Vector<double>* gradient)
+{
+    const int N = Term::size;
+    int n = rows * cols;
+
+    // Anchors whose taps all fall in the frame
+    int di_min = 0, di_max = 0, dj_min = 0, dj_max = 0;
+    for (int t = 0; t < N; t++)
+    {
+        di_min = std::min(di_min, Term::taps[t].di);
+        di_max = std::max(di_max, Term::taps[t].di);
+        dj_min = std::min(dj_min, Term::taps[t].dj);
+        dj_max = std::max(dj_max, Term::taps[t].dj);
+    }
+
+    double energy = 0.0;
+
+    for (int i = -di_min; i < rows - di_max; i++)
+    {
+        for (int j = -dj_min; j < cols - dj_max; j++)
+        {
+            int index[N];
+            for (int t = 0; t < N; t++)
+                index[t] = Term::taps[t].field * n + (i + Term::taps[t].di) * cols + j + Term::taps[t].dj;
+
+            if (!gradient)
+            {
+                double u[N];
+                for (int t = 0; t < N; t++)
+                    u[t] = x.values[index[t]];
+
+                energy += term(u, i, j);
+                continue;
+            }
+
+            Dual<N> u[N];
+            for (int t = 0; t < N; t++)
+                u[t] = Dual<N>::variable(x.values[index[t]], t);
+
+            Dual<N> e = term(u, i, j);
+            energy += e.value;
+
+            for (int t = 0; t < N; t++)
+                gradient->values[index[t]] += e.grad[t];
+        }
+    }
+
+    return energy;
+}
+
+#endif // AUTODIFF_H
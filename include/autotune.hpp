@@ -0,0 +1,52 @@
+#ifndef AUTOTUNE_H
+#define AUTOTUNE_H
+
+#include "./matrix.hpp"
+
+#include <functional>
+#include <string>
+
+/*
+ * Per-host calibration of the solver settings whose best value depends on
+ * the machine and the image size: the L-BFGS history depth, the number
+ * of line-search threads and the layout of the unknowns. A calibration
+ * times short first-stage solves of a synthetic image for candidate
+ * settings, one setting at a time from the defaults (coordinate search),
+ * and records the fastest per host and size class in a text file:
+ *
+ *     <host> <size class> <memory> <line threads> <interleaved> <seconds>
+ *
+ * The file is $SFS_TUNING_FILE, or ~/.cache/sfs-tuning.txt. Solves use
+ * the recorded settings only when asked to (--tuned), so that a result
+ * does not depend on what a calibration left in the file.
+ */
+
+struct TunedSettings
+{
+    int lbfgs_memory = 5;
+    int line_threads = 1;
+    bool interleaved = false;
+    double seconds = 0.0;          // calibration solve time
+};
+
+// Size class of a rows x cols image: floor(log2(pixels))
+int sizeClass(int rows, int cols);
+
+// Settings recorded for this host and size class; false when none
+bool loadTuning(int size_class, TunedSettings& settings);
+
+// Record settings for this host and size class, replacing older ones
+void saveTuning(int size_class, const TunedSettings& settings);
+
+// Smooth synthetic surface shaded by a frontal light, rows x cols grey levels
+Matrix syntheticImage(int rows, int cols);
+
+// Coordinate search over the candidates; measure returns the seconds a
+// calibration solve of image takes with the settings (infinity when it
+// does not converge)
+TunedSettings autotune(
+    const Matrix& image,
+    const std::function<double(const TunedSettings&, const Matrix&)>& measure
+);
+
+#endif // AUTOTUNE_H
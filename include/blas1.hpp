@@ -0,0 +1,37 @@
+#ifndef BLAS1_H
+#define BLAS1_H
+
+// Level-1 kernels over raw double arrays of length n, fused so that a
+// caller pays one memory pass where the Vector<T> operators pay several.
+// Loops run two lanes wide (one SIMD register). Sums are taken per fixed
+// block of elements and the block sums added in order, so the result does
+// not depend on the thread count; threads > 1 only kicks in on vectors
+// long enough to repay starting them.
+
+// x · y
+double dot(int n, const double* x, const double* y, int threads = 1);
+
+// x · a and x · b in one pass
+void dot2(int n, const double* x, const double* a, const double* b,
+          double& xa, double& xb, int threads = 1);
+
+// y += a x
+void axpy(int n, double a, const double* x, double* y, int threads = 1);
+
+// z = a x, then returns w · z (z may be x; w may be null: returns 0)
+double scaleDot(int n, double a, const double* x, double* z, const double* w, int threads = 1);
+
+// z = y + a x, then returns w · z (z may be y; w may be null: returns 0)
+double axpyDot(int n, double a, const double* x, const double* y, double* z,
+               const double* w, int threads = 1);
+
+// z = b (y + a x), then returns w · z (same aliasing rules as axpyDot)
+double axpyScaleDot(int n, double a, const double* x, const double* y, double b,
+                    double* z, const double* w, int threads = 1);
+
+// s = x1 - x0 and y = g1 - g0, returning s · y and y · y
+void differenceDots(int n, const double* x0, const double* x1,
+                    const double* g0, const double* g1, double* s, double* y,
+                    double& sy, double& yy, int threads = 1);
+
+#endif // BLAS1_H
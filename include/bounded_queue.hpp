@@ -0,0 +1,69 @@
+#ifndef BOUNDED_QUEUE_H
+#define BOUNDED_QUEUE_H
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+/**
+ * @brief Fixed-capacity FIFO between pipeline stages
+ *
+ * push() blocks while the queue is full (back-pressure on the producer),
+ * pop() blocks while it is empty. Once close() is called, pushes are
+ * refused and pop() returns false when the queue has drained.
+ */
+template <typename T>
+class BoundedQueue
+{
+public:
+    explicit BoundedQueue(int capacity) : capacity(capacity > 0 ? capacity : 1), closed(false) {}
+
+    // Add an item, waiting for room; false if the queue was closed
+    bool push(T item)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        not_full.wait(lock, [this] { return closed || int(items.size()) < capacity; });
+
+        if (closed)
+            return false;
+
+        items.push_back(std::move(item));
+        not_empty.notify_one();
+        return true;
+    }
+
+    // Take the oldest item, waiting for one; false once closed and drained
+    bool pop(T& item)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        not_empty.wait(lock, [this] { return closed || !items.empty(); });
+
+        if (items.empty())
+            return false;
+
+        item = std::move(items.front());
+        items.pop_front();
+        not_full.notify_one();
+        return true;
+    }
+
+    // No more items will be pushed
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        not_full.notify_all();
+        not_empty.notify_all();
+    }
+
+private:
+    int capacity;
+    bool closed;
+    std::deque<T> items;
+
+    std::mutex mutex;
+    std::condition_variable not_full;
+    std::condition_variable not_empty;
+};
+
+#endif // BOUNDED_QUEUE_H
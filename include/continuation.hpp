@@ -0,0 +1,85 @@
+#ifndef CONTINUATION_H
+#define CONTINUATION_H
+
+#include "./lbfgs.hpp"
+#include "./vector.hpp"
+#include "./globals.hpp"
+
+#include <cmath>
+#include <iostream>
+#include <string>
+
+/*
+ * Continuation on the regularization weights. Heavy smoothing makes the
+ * energy well conditioned, so L-BFGS first solves with lambda_internal
+ * and lambda_csmo of data.weights scaled up by factor^(stages - 1), then
+ * divides them by factor at each stage down to their given values, every stage
+ * warm-started from the previous solution. Intermediate stages stop at a
+ * gradient threshold scaled like the weights; only the last one is held
+ * to epsilon. A single stage is a plain LBFGS call.
+ */
+
+struct ContinuationSchedule
+{
+    int stages = 1;
+    double factor = 10.0;
+};
+
+template <typename Data>
+Vector<double> continuationLBFGS(
+    Vector<double>& x,
+    double (*objective)(const Vector<double>&, const Data&),
+    Vector<double> (*objectiveGradient)(const Vector<double>&, const Data&),
+    const Data& data,
+    double epsilon,
+    const LineSearch<Data>* line,
+    LBFGSControl* control,
+    const ContinuationSchedule& schedule
+)
+{
+    int iterations = 0;
+    double seconds = 0.0;
+
+    for (int stage = schedule.stages - 1; stage > 0; stage--)
+    {
+        double scale = std::pow(schedule.factor, stage);
+        Data stage_data = data;
+        stage_data.weights.lambda_internal *= scale;
+        stage_data.weights.lambda_csmo *= scale;
+
+        LBFGSControl stage_control = control ? *control : LBFGSControl();
+        x = LBFGS(x, objective, objectiveGradient, stage_data, epsilon * scale, line, &stage_control);
+
+        iterations += stage_control.iterations;
+        seconds += stage_control.seconds;
+
+        if (stage_control.verbose)
+            std::cout << "Continuation: weights x" << scale << ", "
+                      << stage_control.iterations << " iterations\n";
+
+        // Out of time or cancelled: the warm start is all there is
+        std::string reason = stage_control.stop_reason;
+        if (reason == "deadline" || reason == "cancelled")
+        {
+            if (control)
+            {
+                *control = stage_control;
+                control->iterations = iterations;
+                control->seconds = seconds;
+            }
+            return x;
+        }
+    }
+
+    Vector<double> result = LBFGS(x, objective, objectiveGradient, data, epsilon, line, control);
+
+    if (control)
+    {
+        control->iterations += iterations;
+        control->seconds += seconds;
+    }
+
+    return result;
+}
+
+#endif // CONTINUATION_H
@@ -0,0 +1,76 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include "./sfs.h"
+
+#include <cstdint>
+#include <string>
+
+/*
+ * Reconstruction server on a Unix domain socket.
+ *
+ * A client connection carries a stream of requests; each starts with a
+ * DaemonRequest header. Solve requests are followed by their image
+ * (rows x cols doubles, row-major) or by the path of a CSV image
+ * (path_length bytes). Every solve request is answered, in completion
+ * order, by a DaemonReply header followed by payload_bytes of result: the
+ * height map (rows x cols doubles) or the mesh text. A cancel request
+ * names a job of the same connection and gets no reply of its own; the
+ * cancelled job answers SFS_CANCELLED, whether it was queued or running.
+ * Closing the connection cancels its jobs.
+ *
+ * Jobs wait in a bounded queue (a full queue stops reading from the
+ * submitting connection) and are solved by a fixed set of worker threads.
+ * Each worker keeps its L-BFGS workspace and line-search threads from one
+ * job to the next.
+ */
+
+enum DaemonRequestType
+{
+    DAEMON_SOLVE_BUFFER = 1,
+    DAEMON_SOLVE_PATH = 2,
+    DAEMON_CANCEL = 3
+};
+
+enum DaemonOutput
+{
+    DAEMON_HEIGHT = 0,
+    DAEMON_MESH = 1
+};
+
+static const uint32_t daemon_request_magic = 0x51534653;   // "SFSQ"
+static const uint32_t daemon_reply_magic = 0x52534653;     // "SFSR"
+
+struct DaemonRequest
+{
+    uint32_t magic;
+    uint32_t type;             // DaemonRequestType
+    uint64_t job;              // chosen by the client, echoed in the reply
+    uint32_t output;           // DaemonOutput
+    int32_t rows, cols;        // buffer jobs
+    uint32_t path_length;      // path jobs
+    double mesh_tolerance;     // mesh output: quadtree tolerance (negative: full resolution)
+    sfs_params params;
+};
+
+struct DaemonReply
+{
+    uint32_t magic;
+    int32_t status;            // SFS_* (SFS_INVALID_ARGUMENT for an unreadable image)
+    uint64_t job;
+    int32_t rows, cols;
+    uint64_t payload_bytes;
+    double seconds;            // solve time
+};
+
+// Serve until SIGINT / SIGTERM with workers concurrent solves and at most
+// queue_capacity waiting jobs; returns the process exit status
+int runDaemon(const std::string& socket_path, int workers, int queue_capacity);
+
+// Client side: solve one CSV image through the daemon and write the mesh;
+// returns the job's SFS_* status (-1 when the daemon cannot be reached)
+int submitJob(const std::string& socket_path, const std::string& input,
+              const std::string& output, const sfs_params& params,
+              double mesh_tolerance = -1.0);
+
+#endif // DAEMON_H
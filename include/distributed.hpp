@@ -0,0 +1,57 @@
+#ifndef DISTRIBUTED_H
+#define DISTRIBUTED_H
+
+#include "./matrix.hpp"
+#include "./globals.hpp"
+#include "./lbfgs.hpp"
+#include "./continuation.hpp"
+
+/*
+ * Multi-process reconstruction: the frame is cut into horizontal bands,
+ * one per worker process. Each worker owns the p, q and height unknowns
+ * of its band; the evaluation point lives in a POSIX shared-memory
+ * segment, so the one-row halos of the stencils are read straight from
+ * the neighbouring bands after a barrier. Every worker runs the shared
+ * LBFGS / continuationLBFGS on its band, with a reduction hook that
+ * combines dot products, stop votes, objectives and line models through
+ * per-worker slots, summed in the same order by every worker so that all
+ * of them take the same decisions.
+ *
+ * Frontal Lambertian energy (objectiveFunction / computeGradient) for the
+ * first stage, heightObjective / heightGradient for the second, with the
+ * same line restrictions as the in-process solve.
+ *
+ * Each worker can be pinned to a core, consecutive bands filling one NUMA
+ * node before the next. Its band of every shared array is first touched
+ * by the worker itself, so those pages are allocated on its node and only
+ * the halo rows are read across nodes.
+ */
+
+// Per-worker view of the shared segment (distributed_solver.cpp)
+struct BandWorker;
+
+// Problem data of a worker's band: the unknowns are its owned rows
+struct BandData
+{
+    BandWorker* worker;
+    EnergyWeights weights;
+};
+
+// Reconstruct the height map of image with num_workers processes. first
+// and second hold the settings of the two stages (memory, verbosity,
+// deadline, early exit, cancel flag) and receive the report of worker 0.
+// memory_limit_mb > 0 caps the address space of every worker.
+Matrix distributedReconstruct(
+    const Matrix& image,
+    const EnergyWeights& weights,
+    int num_workers,
+    double grad_tol_1,
+    double grad_tol_2,
+    LBFGSControl* first,
+    LBFGSControl* second,
+    const ContinuationSchedule& schedule,
+    long memory_limit_mb = 0,
+    bool pin_workers = true
+);
+
+#endif // DISTRIBUTED_H
@@ -1,8 +1,16 @@
 #ifndef GLOBALS_H
 #define GLOBALS_H
 
-extern const int lambda_internal;
-extern const int lambda_csmo;
-extern const double step_size;
+// Weights of the energy terms. They travel in the problem data of every
+// solve (ShadingData, HeightData, MaskedData, RegionWindow), so that
+// concurrent solves and the helper threads of one solve all see the
+// weights of that solve.
+struct EnergyWeights
+{
+    double lambda_internal = 10.0;   // importance of the integrability constraint
+    double lambda_csmo = 10.0;       // importance of solution smoothness
+    double step_size = 1.0;          // discretization step (square root of the
+                                     // importance of the data term)
+};
 
 #endif // GLOBALS_H
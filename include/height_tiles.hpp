@@ -0,0 +1,100 @@
+#ifndef HEIGHT_TILES_H
+#define HEIGHT_TILES_H
+
+#include "./matrix.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/*
+ * Binary tiled height map. Level 0 is the full-resolution map; each
+ * further level (overview) halves both sides by averaging 2 x 2 blocks,
+ * down to a level that fits in one tile. Every level is cut into
+ * tile_size x tile_size tiles (smaller on the last row and column),
+ * listed row-major in a per-level index giving each tile's offset, size
+ * and encoding, so any tile of any level is read on its own.
+ *
+ * File layout (native byte order):
+ *   TileFileHeader
+ *   TileLevel[levels]
+ *   TileEntry[tiles of level 0], TileEntry[tiles of level 1], ...
+ *   tile data, each tile 8-byte aligned
+ *
+ * A raw tile holds its doubles row-major. A delta tile holds, for each
+ * height in the same order, the difference of its 64-bit pattern with
+ * the one on its left (above, in the first column), zigzag-mapped and
+ * written as a base-128 varint: lossless, and smooth or flat areas take
+ * a few bytes per height. Each tile keeps the smaller of the two.
+ */
+
+enum TileEncoding
+{
+    TILE_RAW = 0,
+    TILE_DELTA = 1
+};
+
+struct TileFileHeader
+{
+    char magic[8];             // "SFSTILE1"
+    int32_t rows, cols;        // level 0
+    int32_t tile_size;
+    int32_t levels;
+};
+
+struct TileLevel
+{
+    int32_t rows, cols;
+    int32_t tiles_down, tiles_across;
+    uint64_t index_offset;     // first TileEntry of the level
+};
+
+struct TileEntry
+{
+    uint64_t offset;           // tile data
+    uint32_t bytes;
+    uint32_t encoding;         // TileEncoding
+};
+
+// Write height as a tiled file; delta enables the delta encoding. Throws
+// std::runtime_error on an empty height map, a bad tile size or a failed write
+void writeHeightTiles(
+    const std::string& filename,
+    const Matrix& height,
+    int tile_size = 256,
+    bool delta = true
+);
+
+// Memory-mapped reader of a tiled height map. A file that cannot be read
+// or whose header and indexes do not hold together throws
+// std::runtime_error from the constructor, a corrupted tile from tile()
+// and region(); a level, tile or region out of range throws
+// std::out_of_range. The reader stays usable after either.
+class HeightTileReader
+{
+public:
+    explicit HeightTileReader(const std::string& filename);
+    ~HeightTileReader();
+
+    HeightTileReader(const HeightTileReader&) = delete;
+    HeightTileReader& operator=(const HeightTileReader&) = delete;
+
+    int levels() const { return header->levels; }
+    int tileSize() const { return header->tile_size; }
+    const TileLevel& level(int l) const;
+
+    // Decode one tile (0-based tile coordinates)
+    Matrix tile(int l, int tile_row, int tile_col) const;
+
+    // Heights [row, row + rows) x [col, col + cols) of a level, decoding
+    // only the tiles that overlap the region
+    Matrix region(int l, int row, int col, int rows, int cols) const;
+
+private:
+    const unsigned char* data;
+    size_t size;
+    const TileFileHeader* header;
+    const TileLevel* level_table;
+};
+
+#endif // HEIGHT_TILES_H
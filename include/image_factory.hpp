@@ -3,26 +3,42 @@
 
 #include "./matrix.hpp"
 #include "./vector.hpp"
+#include "./vec.hpp"
+
+#include <vector>
 
 class ImageFactory
 {
 public:
     int num_vertices;
     int num_quadrilaterals;   // number of vertices / quadrilaterals in the mesh
+    int num_triangles;        // number of triangles in the mesh
 
     int image_width;
-    int image_height;         // image dimensions (pixels)
+    int image_height;         // image dimensions (pixels): rows along x, columns along y
+
+    double origin_x;
+    double origin_y;          // mesh coordinates of the image corner
 
-    Matrix vertices;          // mesh vertices
-    Matrix quadrilaterals;    // mesh quadrilaterals (vertex indices)
+    int tile_size;            // side of the screen tiles rasterized by each thread (pixels)
+
+    std::vector<Vec3d> vertices;               // mesh vertices
+    std::vector<Vec<int, 4>> quadrilaterals;   // mesh quadrilaterals (vertex indices)
+    std::vector<Vec<int, 3>> triangles;        // mesh triangles (vertex indices)
     Matrix image;             // grayscale image (values 0–255)
     Matrix height_derivatives;// directional derivatives of height at each image point
 
     explicit ImageFactory(const char* filename);     // constructor that reads a mesh file
-    void flatten(Vecteur<double>& source);            // 3D mesh → 2D matrix
+    void flatten(Vector<double>& source,              // 3D mesh → 2D matrix (z-buffer rasterizer,
+                 int num_threads = 0);                //  0 threads = one per hardware core)
     void save2D(const char* filename);                 // save 2D matrix to file
 };
 
-Matrix csvToMatrix(const char* csv_file);              // convert CSV file to matrix
+Matrix csvToMatrix(const char* csv_file);              // convert CSV file to matrix (exits on error)
+
+// Same, for long-running hosts: false, with the reason in error, when the
+// file cannot be opened, is malformed or truncated, or holds more than
+// max_pixels pixels (checked before allocating; negative: no limit)
+bool readCsvMatrix(const char* csv_file, Matrix& M, std::string& error, long max_pixels = -1);
 
 #endif // IMAGE_FACTORY_H
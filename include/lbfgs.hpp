@@ -2,39 +2,192 @@
 #define LBFGS_H
 
 #include "matrix.hpp"
+#include "globals.hpp"
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <ostream>
 #include <string>
 
+class FrameArena;
+class TrialPool;
+
 Vector<double> computeGradient(
     const Vector<double>& x,
-    const Matrix& image
+    const Matrix& image,
+    const EnergyWeights& weights
 );
 
 double objectiveFunction(
     const Vector<double>& x,
-    const Matrix& image
+    const Matrix& image,
+    const EnergyWeights& weights
 );
 
+// Sub-problem of a region re-solve: a window cut out of the frame whose
+// outer ring is frozen on every side that borders the rest of the frame
+struct RegionWindow
+{
+    Matrix image;          // cropped image
+    EnergyWeights weights;
+    bool frozen_top;
+    bool frozen_bottom;
+    bool frozen_left;
+    bool frozen_right;
+};
+
+// Problem data of the height stage: the slopes p then q (2 rows x cols)
+// and the energy weights (the step size is the one used)
+struct HeightData
+{
+    const Matrix* derivatives;
+    EnergyWeights weights;
+};
+
+// Quadratic part of an objective restricted to the line x + alpha d:
+// constant + linear alpha + quadratic alpha²
+struct LineModel
+{
+    double constant;
+    double linear;
+    double quadratic;
+};
+
+// Line restriction of an objective, for the line search. prepare() makes
+// one pass per search direction over the exactly quadratic terms;
+// remainder() returns the other terms at x + alpha d and their derivative
+// in alpha in one pass. A null remainder means the objective is quadratic,
+// and the exact minimizing step is taken.
+template <typename Data>
+struct LineSearch
+{
+    LineModel (*prepare)(const Vector<double>& x, const Vector<double>& d, const Data& data);
+    double (*remainder)(const Vector<double>& x, const Vector<double>& d, double alpha,
+                        const Data& data, double& slope);
+};
+
+// Settings of an L-BFGS run (memory, output, stopping rules beyond the
+// gradient-norm threshold and the iteration limit) and the report of how
+// the run ended. With a deadline, the best iterate seen is returned when
+// time runs out.
+struct LBFGSControl
+{
+    typedef std::chrono::steady_clock Clock;
+
+    // Rules
+    int memory = 5;                    // number of stored correction pairs
+    bool verbose = true;               // per-iteration progress on std::cout
+    bool has_deadline = false;
+    Clock::time_point deadline;        // wall-clock limit
+    double min_decrease = 0.0;         // least relative objective decrease over
+    int window = 10;                   // the last window iterations (0: no check)
+    int parallel_trials = 1;           // line-search steps evaluated at once, one per thread
+    int kernel_threads = 1;            // threads of the vector kernels on long vectors
+    const std::atomic<bool>* cancel = nullptr;  // polled every iteration: stop when set
+    FrameArena* workspace = nullptr;   // caller's arena, kept warm between runs (null: own)
+    TrialPool* trial_pool = nullptr;   // caller's line-search threads, kept warm between runs
+                                       // (null or too small: own)
+
+    // Distributed solve: x is this process's share of the unknowns, and
+    // reduce replaces count partial sums by their totals over all shares,
+    // identical everywhere. The solver reduces its dot products and stop
+    // votes; objectives and line models come back already summed from the
+    // problem data. Line-search trials then run one at a time.
+    std::function<void(double* values, int count)> reduce;
+
+    // Report
+    const char* stop_reason = "";      // "gradient", "iterations", "deadline", "stalled"
+                                       // or "cancelled"
+    int iterations = 0;
+    double objective = 0.0;            // at the returned point (when known)
+    double gradient_norm = 0.0;
+    double seconds = 0.0;
+};
+
+// L-BFGS minimization, templated on the problem data passed through
+// to the objective and its gradient (explicitly instantiated in lbfgs.cpp)
+template <typename Data>
 Vector<double> LBFGS(
     Vector<double>& x,
-    double (*objective)(const Vector<double>&, const Matrix&),
-    Vector<double> (*objectiveGradient)(const Vector<double>&, const Matrix&),
+    double (*objective)(const Vector<double>&, const Data&),
+    Vector<double> (*objectiveGradient)(const Vector<double>&, const Data&),
+    const Data& data,
+    double epsilon,
+    const LineSearch<Data>* line = nullptr,
+    LBFGSControl* control = nullptr
+);
+
+// Line restrictions of objectiveFunction and heightObjective
+LineModel objectiveLinePrepare(
+    const Vector<double>& x,
+    const Vector<double>& d,
     const Matrix& image,
-    double epsilon
+    const EnergyWeights& weights
 );
 
-Vector<double> heightGradient(
+double objectiveLineRemainder(
     const Vector<double>& x,
-    const Matrix& height
+    const Vector<double>& d,
+    double alpha,
+    const Matrix& image,
+    const EnergyWeights& weights,
+    double& slope
+);
+
+LineModel heightLinePrepare(
+    const Vector<double>& h,
+    const Vector<double>& d,
+    const HeightData& data
+);
+
+Vector<double> heightGradient(
+    const Vector<double>& h,
+    const HeightData& data
 );
 
 double heightObjective(
-    const Vector<double>& x,
-    const Matrix& height
+    const Vector<double>& h,
+    const HeightData& data
 );
 
+// Re-optimize the rectangle [row_min, row_max] x [col_min, col_max]
+// (1-based, inclusive) plus a halo of surrounding pixels, keeping the rest
+// of the previous solution fixed, and patch x (p then q) and height in
+// place. False, with the reason in error and nothing patched, when the
+// region or the previous solution does not fit the image.
+bool resolveRegion(
+    Vector<double>& x,
+    Matrix& height,
+    const Matrix& image,
+    const EnergyWeights& weights,
+    int row_min, int col_min,
+    int row_max, int col_max,
+    int halo,
+    double grad_tol_1,
+    double grad_tol_2,
+    std::string& error
+);
+
+// Save a height map as a mesh: one quadrilateral per pixel cell, or with a
+// non-negative tolerance the adaptive mesh of writeAdaptiveMesh
 void matrixToMesh(
     const std::string& filename,
+    const Matrix& M,
+    double tolerance = -1.0
+);
+
+void writeMesh(
+    std::ostream& mesh,
     const Matrix& M
 );
 
+// Mesh whose cells are merged by a quadtree while the heights stay within
+// tolerance of the bilinear surface through the cell corners; crack-free
+// (quadrilaterals, and triangle fans where neighbours are smaller)
+void writeAdaptiveMesh(
+    std::ostream& mesh,
+    const Matrix& M,
+    double tolerance
+);
+
 #endif // LBFGS_H
@@ -9,18 +9,23 @@ class Vector;
 
 /**
  * @brief General dense matrix class
+ *
+ * Rows are stored contiguously; storage comes from the thread's active
+ * FrameArena when one is set (see arena.hpp), from the heap otherwise.
  */
 class Matrix
 {
 public:
     int rows, cols;        // number of rows and columns
     double** values;       // matrix values
+    bool pooled;           // storage owned by an arena
 
     // Constructors
     Matrix();                                      // default constructor
     Matrix(int r, int c);                           // size constructor, initialized to 0
     Matrix(int r, int c, double value);             // size + constant value
     Matrix(const Matrix& M);                        // copy constructor
+    Matrix(Matrix&& M) noexcept;                    // move constructor (takes the storage)
     Matrix(int n, const std::string& id);           // identity matrix constructor
 
     // Destructor
@@ -28,6 +33,7 @@ public:
 
     // Assignment
     Matrix& operator=(const Matrix& M);
+    Matrix& operator=(Matrix&& M) noexcept;
 
     // Element access
     double& operator()(int i, int j) const;
@@ -54,6 +60,10 @@ public:
     // Display
     void print() const;
     friend std::ostream& operator<<(std::ostream&, const Matrix& M);
+
+private:
+    void allocate(int r, int c);                    // set size and storage (uninitialized)
+    void release();                                 // give storage back
 };
 
 // Utility functions
@@ -0,0 +1,27 @@
+#ifndef NUMA_TOPOLOGY_H
+#define NUMA_TOPOLOGY_H
+
+#include <vector>
+
+/*
+ * NUMA layout of the CPUs this process may run on, read from
+ * /sys/devices/system/node (one node holding every allowed CPU when the
+ * kernel exposes no topology). Used to keep each band of the
+ * multi-process solve on one core, next to the memory it first touched.
+ */
+
+struct NumaTopology
+{
+    std::vector<std::vector<int>> node_cpus;   // allowed CPUs of each node with any
+};
+
+NumaTopology readNumaTopology();
+
+// CPU of worker w out of num_workers: consecutive workers (neighbouring
+// bands) fill one node before moving on to the next
+int workerCpu(const NumaTopology& topology, int w, int num_workers);
+
+// Bind the calling thread to cpu; false when the kernel refuses
+bool pinToCpu(int cpu);
+
+#endif // NUMA_TOPOLOGY_H
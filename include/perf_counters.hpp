@@ -0,0 +1,54 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <cstdint>
+#include <ostream>
+
+/*
+ * Optional hardware-counter instrumentation of the solver kernels and
+ * pipeline phases. While enabled, every PerfScope adds its wall time and
+ * the Linux perf_event counts of the calling thread (cycles,
+ * instructions, last-level cache misses, branch misses) to the totals of
+ * its phase; counts of a multiplexed group are scaled up by its enabled
+ * over running time. Where the counters cannot be opened (no PMU access, a
+ * restrictive perf_event_paranoid, a container) only wall time and call
+ * counts are kept, and the report says so.
+ *
+ * Bytes moved are estimated as one 64-byte line per last-level cache miss.
+ */
+
+// Enable or disable collection (off by default; a disabled scope costs one test)
+void setPerfEnabled(bool enabled);
+bool perfEnabled();
+
+// Per-phase totals: calls, seconds, IPC, misses and bytes per pixel,
+// achieved bandwidth
+void printPerfReport(std::ostream& out);
+
+// Counts of the calling thread between construction and destruction,
+// added to the phase's totals. phase must outlive the program (a literal);
+// pixels is the work of one call, for the per-pixel figures. with_children
+// also counts the threads and processes started inside the scope (a whole
+// solve, not a kernel).
+class PerfScope
+{
+public:
+    PerfScope(const char* phase, long pixels, bool with_children = false);
+    ~PerfScope();
+
+    // Work of the call when it is only known at the end (e.g. a load)
+    void setPixels(long n) { pixels = n; }
+
+    PerfScope(const PerfScope&) = delete;
+    PerfScope& operator=(const PerfScope&) = delete;
+
+private:
+    const char* phase;
+    long pixels;
+    bool active;
+    bool with_children;
+    double start_seconds;
+    uint64_t start[6];      // counts, time enabled, time running
+};
+
+#endif // PERF_COUNTERS_H
@@ -0,0 +1,35 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "./matrix.hpp"
+
+#include <functional>
+#include <string>
+#include <vector>
+
+/*
+ * Batch reconstruction as three overlapping stages: a loader thread
+ * parses the next CSV images, the calling thread solves the current one
+ * and a writer thread serializes the previous meshes. The stages are
+ * linked by bounded queues of queue_capacity items, so at most
+ * 2 * queue_capacity + 3 frames are alive at any time whatever the
+ * length of the batch.
+ */
+
+struct PipelineJob
+{
+    std::string input;     // CSV image
+    std::string output;    // mesh file
+};
+
+// Run every job through load → solve → export, in order. A job whose
+// image cannot be read is reported and skipped; returns the number of
+// such jobs.
+int runPipeline(
+    const std::vector<PipelineJob>& jobs,
+    const std::function<Matrix(const Matrix&)>& solve,
+    int queue_capacity = 2,
+    double mesh_tolerance = -1.0    // adaptive meshes (negative: full resolution)
+);
+
+#endif // PIPELINE_H
@@ -0,0 +1,290 @@
+#ifndef REFLECTANCE_H
+#define REFLECTANCE_H
+
+#include "./matrix.hpp"
+#include "./vector.hpp"
+#include "./vec.hpp"
+#include "./lbfgs.hpp"
+#include "./sensor_image.hpp"
+#include "./globals.hpp"
+
+#include <cmath>
+
+/*
+ * Reflectance models used as compile-time policies by the shading energy.
+ *
+ * A facet with height derivatives (p, q) has unit normal
+ * n = (-p, -q, 1) / sqrt(1 + p² + q²); the camera looks along +z and the
+ * light direction L is fixed for the image. With s = 1 + p² + q² and
+ * a = L·(-p, -q, 1):
+ *     mu0 = cos(incidence) = a / sqrt(s),   mu = cos(emission) = 1 / sqrt(s)
+ *
+ * Every model provides
+ *     double radiance(p, q)                     grey level
+ *     void shade(p, q, R, R_p, R_q)             grey level and its derivatives
+ * scaled so that a facet lit and seen head-on (mu0 = mu = 1) gives 255.
+ * No clamping is applied to self-shadowed facets (mu0 <= 0), to keep the
+ * energy smooth.
+ */
+
+// Lambertian, light along the viewing direction: R = 255 / sqrt(s)
+struct FrontalLambertian
+{
+    double radiance(double p, double q) const
+    {
+        return 255.0 / std::sqrt(1.0 + p * p + q * q);
+    }
+
+    void shade(double p, double q, double& R, double& R_p, double& R_q) const
+    {
+        double s = 1.0 + p * p + q * q;
+        double root = std::sqrt(s);
+
+        R = 255.0 / root;
+        R_p = -R * p / s;
+        R_q = -R * q / s;
+    }
+};
+
+// Lambertian, any light direction: R = 255 mu0
+struct Lambertian
+{
+    Vec3d light;
+
+    explicit Lambertian(const Vec3d& L) : light(normalize(L)) {}
+
+    double radiance(double p, double q) const
+    {
+        double a = light(3) - light(1) * p - light(2) * q;
+        return 255.0 * a / std::sqrt(1.0 + p * p + q * q);
+    }
+
+    void shade(double p, double q, double& R, double& R_p, double& R_q) const
+    {
+        double s = 1.0 + p * p + q * q;
+        double a = light(3) - light(1) * p - light(2) * q;
+        double scale = 255.0 / (s * std::sqrt(s));
+
+        R = 255.0 * a / std::sqrt(s);
+        R_p = scale * (-light(1) * s - a * p);
+        R_q = scale * (-light(2) * s - a * q);
+    }
+};
+
+// Lommel–Seeliger (dark regolith, single scattering): R = 510 mu0 / (mu0 + mu),
+// which reduces to 510 a / (a + 1)
+struct LommelSeeliger
+{
+    Vec3d light;
+
+    explicit LommelSeeliger(const Vec3d& L) : light(normalize(L)) {}
+
+    double radiance(double p, double q) const
+    {
+        double a = light(3) - light(1) * p - light(2) * q;
+        return 510.0 * a / (a + 1.0);
+    }
+
+    void shade(double p, double q, double& R, double& R_p, double& R_q) const
+    {
+        double a = light(3) - light(1) * p - light(2) * q;
+        double d = 1.0 / (a + 1.0);
+
+        R = 510.0 * a * d;
+        R_p = -510.0 * light(1) * d * d;
+        R_q = -510.0 * light(2) * d * d;
+    }
+};
+
+// Simplified Hapke: single-scattering albedo w, one-term phase function
+// P(g) = 1 + b cos g, shadow-hiding opposition surge B(g) = B0 / (1 + tan(g/2) / h)
+// and Chandrasekhar H(x) = (1 + 2x) / (1 + 2 gamma x), gamma = sqrt(1 - w).
+// The phase angle g is the same for every pixel, so P and B are constants.
+//     R ∝ mu0 / (mu0 + mu) [P (1 + B) + H(mu0) H(mu) - 1]
+struct HapkeLite
+{
+    Vec3d light;
+    double gamma;          // sqrt(1 - w)
+    double K;              // P(g) (1 + B(g))
+    double scale;          // grey level normalization
+
+    explicit HapkeLite(const Vec3d& L, double w = 0.3, double b = 0.0,
+                       double B0 = 1.0, double h = 0.06)
+        : light(normalize(L))
+    {
+        gamma = std::sqrt(1.0 - w);
+
+        double g = std::acos(light(3));          // phase angle (camera on +z)
+        double P = 1.0 + b * std::cos(g);
+        double B = B0 / (1.0 + std::tan(g / 2.0) / h);
+        K = P * (1.0 + B);
+
+        double H1 = H(1.0);
+        scale = 255.0 / (0.5 * (K + H1 * H1 - 1.0));
+    }
+
+    double H(double x) const
+    {
+        return (1.0 + 2.0 * x) / (1.0 + 2.0 * gamma * x);
+    }
+
+    double dH(double x) const
+    {
+        double d = 1.0 + 2.0 * gamma * x;
+        return 2.0 * (1.0 - gamma) / (d * d);
+    }
+
+    double radiance(double p, double q) const
+    {
+        double s = 1.0 + p * p + q * q;
+        double mu = 1.0 / std::sqrt(s);
+        double mu0 = (light(3) - light(1) * p - light(2) * q) * mu;
+
+        return scale * mu0 / (mu0 + mu) * (K + H(mu0) * H(mu) - 1.0);
+    }
+
+    void shade(double p, double q, double& R, double& R_p, double& R_q) const
+    {
+        double s = 1.0 + p * p + q * q;
+        double mu = 1.0 / std::sqrt(s);
+        double a = light(3) - light(1) * p - light(2) * q;
+        double mu0 = a * mu;
+
+        double H0 = H(mu0);
+        double Hv = H(mu);
+        double M = K + H0 * Hv - 1.0;
+        double sum = mu0 + mu;
+        double ratio = mu0 / sum;
+
+        R = scale * ratio * M;
+
+        // Partial derivatives w.r.t. mu0 and mu
+        double f_mu0 = mu / (sum * sum) * M + ratio * dH(mu0) * Hv;
+        double f_mu = -mu0 / (sum * sum) * M + ratio * H0 * dH(mu);
+
+        // Chain rule through mu0(p, q) and mu(p, q)
+        double mu3 = mu / s;
+        double mu_p = -p * mu3;
+        double mu_q = -q * mu3;
+        double mu0_p = (-light(1) * s - a * p) * mu3;
+        double mu0_q = (-light(2) * s - a * q) * mu3;
+
+        R_p = scale * (f_mu0 * mu0_p + f_mu * mu_p);
+        R_q = scale * (f_mu0 * mu0_q + f_mu * mu_q);
+    }
+};
+
+// Problem data for the shading energy: the image, its reflectance model
+// and the energy weights. The image is a Matrix of grey levels or a
+// SensorImage of 8- or 16-bit samples, read through greyLevel().
+template <typename Model, typename Image = Matrix>
+struct ShadingData
+{
+    const Image* image;
+    Model model;
+    EnergyWeights weights;
+};
+
+// Shading energy for a given reflectance model (explicitly instantiated
+// for the models and image types above in objective_function.cpp /
+// objective_gradient.cpp)
+template <typename Model, typename Image>
+double shadingObjective(const Vector<double>& x, const ShadingData<Model, Image>& data);
+
+template <typename Model, typename Image>
+Vector<double> shadingGradient(const Vector<double>& x, const ShadingData<Model, Image>& data);
+
+// The same energy with the gradient generated from its stencil terms by
+// automatic differentiation (autodiff_shading.cpp, same instantiations).
+// This is the exact gradient of shadingObjective, border pixels included.
+template <typename Model, typename Image>
+double autodiffShadingObjective(const Vector<double>& x, const ShadingData<Model, Image>& data);
+
+template <typename Model, typename Image>
+Vector<double> autodiffShadingGradient(const Vector<double>& x, const ShadingData<Model, Image>& data);
+
+// Line restriction of the shading energy (see LineSearch in lbfgs.hpp),
+// instantiated in line_search.cpp
+template <typename Model, typename Image>
+LineModel shadingLinePrepare(
+    const Vector<double>& x,
+    const Vector<double>& d,
+    const ShadingData<Model, Image>& data
+);
+
+template <typename Model, typename Image>
+double shadingLineRemainder(
+    const Vector<double>& x,
+    const Vector<double>& d,
+    double alpha,
+    const ShadingData<Model, Image>& data,
+    double& slope
+);
+
+// The shading energy on the interleaved layout (p0, q0, p1, q1, ...) of
+// the unknowns, with its gradient and line restriction
+// (interleaved_shading.cpp, same instantiations); interleaveSlopes and
+// splitSlopes convert from and to the p-then-q layout
+Vector<double> interleaveSlopes(const Vector<double>& x);
+Vector<double> splitSlopes(const Vector<double>& x);
+
+template <typename Model, typename Image>
+double interleavedShadingObjective(const Vector<double>& x, const ShadingData<Model, Image>& data);
+
+template <typename Model, typename Image>
+Vector<double> interleavedShadingGradient(const Vector<double>& x, const ShadingData<Model, Image>& data);
+
+template <typename Model, typename Image>
+LineModel interleavedShadingLinePrepare(
+    const Vector<double>& x,
+    const Vector<double>& d,
+    const ShadingData<Model, Image>& data
+);
+
+template <typename Model, typename Image>
+double interleavedShadingLineRemainder(
+    const Vector<double>& x,
+    const Vector<double>& d,
+    double alpha,
+    const ShadingData<Model, Image>& data,
+    double& slope
+);
+
+// Single-stage energy in the height field, with the slopes taken as
+// forward differences of h (direct_height.cpp); same line-search split
+// as the shading energy
+template <typename Model>
+double directHeightObjective(const Vector<double>& h, const ShadingData<Model>& data);
+
+template <typename Model>
+Vector<double> directHeightGradient(const Vector<double>& h, const ShadingData<Model>& data);
+
+template <typename Model>
+LineModel directHeightLinePrepare(
+    const Vector<double>& h,
+    const Vector<double>& d,
+    const ShadingData<Model>& data
+);
+
+template <typename Model>
+double directHeightLineRemainder(
+    const Vector<double>& h,
+    const Vector<double>& d,
+    double alpha,
+    const ShadingData<Model>& data,
+    double& slope
+);
+
+// Coarse-to-fine single-stage reconstruction: height map of image
+// (rows x cols, row-major), L-BFGS stopped at grad_tol on every level.
+// A deadline in control is shared between the levels by pixel count.
+template <typename Model>
+Vector<double> directHeightReconstruct(
+    const Matrix& image,
+    const Model& model,
+    const EnergyWeights& weights,
+    double grad_tol,
+    LBFGSControl* control = nullptr
+);
+
+#endif // REFLECTANCE_H
@@ -0,0 +1,50 @@
+#ifndef RESULT_CACHE_H
+#define RESULT_CACHE_H
+
+#include "./matrix.hpp"
+#include "./globals.hpp"
+
+#include <string>
+
+/*
+ * Content-addressed on-disk cache of reconstructions. An entry is keyed
+ * by a 64-bit FNV-1a hash of the input raster, the energy weights
+ * (lambda_internal, lambda_csmo, step_size) and a caller-supplied
+ * description of the remaining solver settings. Entries are written to a
+ * uniquely named temporary file and renamed into place, so a crash never
+ * leaves a partial entry behind (its temporary is removed by a later
+ * eviction); a checksum guards against corrupted files. The
+ * directory is kept under max_bytes by evicting the least recently used
+ * entries (file modification time, refreshed on every hit).
+ */
+
+// Solver output kept in an entry
+struct CachedResult
+{
+    Matrix derivatives;    // [p; q] (2 rows x cols), empty when not recovered
+    Matrix height;         // height map
+};
+
+class ResultCache
+{
+public:
+    ResultCache(const std::string& directory, long max_bytes);
+
+    // Key of a reconstruction of image with the given settings
+    std::string key(const Matrix& image, const EnergyWeights& weights, const std::string& settings) const;
+
+    // Fetch an entry; false on a miss or an unreadable entry
+    bool load(const std::string& key, CachedResult& result) const;
+
+    // Store an entry atomically, then evict down to the size bound
+    void store(const std::string& key, const CachedResult& result) const;
+
+private:
+    std::string directory;
+    long max_bytes;
+
+    std::string entryPath(const std::string& key) const;
+    void evict() const;
+};
+
+#endif // RESULT_CACHE_H
@@ -0,0 +1,75 @@
+#ifndef SENSOR_IMAGE_H
+#define SENSOR_IMAGE_H
+
+#include "./matrix.hpp"
+
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+/**
+ * @brief Image of integer sensor samples (uint8_t or uint16_t)
+ *
+ * Samples are stored row-major at their native width, 1-2 bytes per pixel
+ * instead of the 8 of a Matrix; the grey level seen by the shading energy
+ * is scale * sample (the image's radiometric scale).
+ */
+template <typename Sample>
+struct SensorImage
+{
+    int rows, cols;
+    double scale;                  // grey level per sample unit
+    std::vector<Sample> samples;   // rows x cols, row-major
+};
+
+// Grey level of pixel (i, j), 0-based, for every image type the shading
+// energy accepts
+inline double greyLevel(const Matrix& image, int i, int j)
+{
+    return image.values[i][j];
+}
+
+template <typename Sample>
+inline double greyLevel(const SensorImage<Sample>& image, int i, int j)
+{
+    return image.scale * image.samples[size_t(i) * image.cols + j];
+}
+
+// Quantize grey levels to samples: scale <= 0 picks the scale that maps
+// the brightest pixel to the largest sample value
+template <typename Sample>
+SensorImage<Sample> quantizeImage(const Matrix& image, double scale = 0.0)
+{
+    const double max_sample = std::numeric_limits<Sample>::max();
+
+    if (scale <= 0.0)
+    {
+        double brightest = 0.0;
+        for (int i = 0; i < image.rows; i++)
+            for (int j = 0; j < image.cols; j++)
+                brightest = std::fmax(brightest, image.values[i][j]);
+
+        scale = brightest > 0.0 ? brightest / max_sample : 1.0;
+    }
+
+    SensorImage<Sample> sensor;
+    sensor.rows = image.rows;
+    sensor.cols = image.cols;
+    sensor.scale = scale;
+    sensor.samples.resize(size_t(image.rows) * image.cols);
+
+    for (int i = 0; i < image.rows; i++)
+    {
+        for (int j = 0; j < image.cols; j++)
+        {
+            double sample = std::round(image.values[i][j] / scale);
+            sensor.samples[size_t(i) * image.cols + j] =
+                Sample(std::fmin(std::fmax(sample, 0.0), max_sample));
+        }
+    }
+
+    return sensor;
+}
+
+#endif // SENSOR_IMAGE_H
@@ -0,0 +1,91 @@
+#ifndef SFS_H
+#define SFS_H
+
+/*
+ * C interface of libsfs: shape from shading on in-memory buffers.
+ *
+ * Images and height maps are rows x cols, row-major. Every call is
+ * reentrant: the energy weights, tolerances and L-BFGS settings travel in
+ * an sfs_params, so concurrent calls from different threads may use
+ * different parameters. Nothing is printed unless params->verbose is set.
+ */
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Status codes */
+enum
+{
+    SFS_OK = 0,
+    SFS_INVALID_ARGUMENT = 1,   /* null buffer, image smaller than 2 x 2 or over
+                                   INT_MAX / 2 pixels, bad parameter */
+    SFS_OUT_OF_MEMORY = 2,
+    SFS_INCOMPLETE = 3,         /* time budget ran out: height holds the best iterate */
+    SFS_CANCELLED = 4,          /* stopped on request (C++ interface, daemon) */
+    SFS_INTERNAL_ERROR = 5      /* unexpected failure, e.g. no thread could be started */
+};
+
+/* Largest accepted settings (sfs_params beyond these: SFS_INVALID_ARGUMENT) */
+enum
+{
+    SFS_MAX_LBFGS_MEMORY = 1000,
+    SFS_MAX_CONTINUATION_STAGES = 100,
+    SFS_MAX_LINE_THREADS = 256
+};
+
+/* Reflectance models */
+enum
+{
+    SFS_MODEL_FRONTAL = 0,      /* Lambertian, light along the viewing direction */
+    SFS_MODEL_LAMBERT = 1,
+    SFS_MODEL_LOMMEL_SEELIGER = 2,
+    SFS_MODEL_HAPKE = 3
+};
+
+typedef struct sfs_params
+{
+    double lambda_internal;     /* integrability weight */
+    double lambda_csmo;         /* smoothness weight */
+    double step_size;           /* discretization step */
+
+    double grad_tol_1;          /* gradient-norm threshold of the first stage */
+    double grad_tol_2;          /* gradient-norm threshold of the height stage */
+    int lbfgs_memory;           /* stored correction pairs */
+    int continuation_stages;    /* first stage: weights stepped down over this many solves */
+    double continuation_factor; /* weight ratio between consecutive continuation stages */
+
+    int model;                  /* SFS_MODEL_* */
+    double light[3];            /* light direction (not used by SFS_MODEL_FRONTAL) */
+
+    int direct;                 /* non-zero: single-stage solve on the height field */
+    double time_budget;         /* wall-clock seconds (0: none) */
+    int line_threads;           /* line-search steps evaluated at once, and
+                                   threads of the long-vector kernels */
+    int verbose;                /* non-zero: L-BFGS progress on standard output */
+} sfs_params;
+
+/* Fill params with the defaults of the command-line tool */
+void sfs_default_params(sfs_params* params);
+
+/* Reconstruct the height map of an image of grey levels (0-255 scale) */
+int sfs_reconstruct(const double* image, int rows, int cols,
+                    const sfs_params* params, double* height);
+
+/* Same, from 8- or 16-bit samples; grey level = scale * sample */
+int sfs_reconstruct_u8(const uint8_t* image, int rows, int cols, double scale,
+                       const sfs_params* params, double* height);
+
+int sfs_reconstruct_u16(const uint16_t* image, int rows, int cols, double scale,
+                        const sfs_params* params, double* height);
+
+/* Text of a status code */
+const char* sfs_status_string(int status);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SFS_H */
@@ -0,0 +1,50 @@
+#ifndef SFS_HPP
+#define SFS_HPP
+
+#include "./sfs.h"
+#include "./matrix.hpp"
+
+#include <atomic>
+#include <cstdint>
+
+class FrameArena;
+class TrialPool;
+
+/*
+ * C++ interface of libsfs. The parameters are the C sfs_params (see
+ * sfs.h); SfsParameters fills in the defaults.
+ */
+
+struct SfsParameters : sfs_params
+{
+    SfsParameters() { sfs_default_params(this); }
+};
+
+// Per-call resources and report of the C++ interface (all optional)
+struct SfsContext
+{
+    const std::atomic<bool>* cancel = nullptr;  // set by another thread to stop the solve
+    FrameArena* workspace = nullptr;            // L-BFGS workspace kept warm between calls
+    TrialPool* trial_pool = nullptr;            // line-search threads kept warm between calls
+
+    // Report: how the solve went
+    int iterations[2] = { 0, 0 };     // per stage (the direct solve only uses the first)
+    double objective[2] = { 0.0, 0.0 };  // final objective per stage
+    double seconds = 0.0;             // wall-clock time of the solve
+};
+
+// Height map of image (grey levels), resized to the image; returns an SFS_* status
+int sfsReconstruct(const Matrix& image, const sfs_params& params, Matrix& height,
+                   SfsContext* context = nullptr);
+
+// Buffer versions: image and height are rows x cols, row-major
+int sfsReconstruct(const double* image, int rows, int cols, const sfs_params& params,
+                   double* height, SfsContext* context = nullptr);
+
+int sfsReconstruct(const uint8_t* image, int rows, int cols, double scale,
+                   const sfs_params& params, double* height, SfsContext* context = nullptr);
+
+int sfsReconstruct(const uint16_t* image, int rows, int cols, double scale,
+                   const sfs_params& params, double* height, SfsContext* context = nullptr);
+
+#endif // SFS_HPP
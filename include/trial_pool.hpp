@@ -0,0 +1,55 @@
+#ifndef TRIAL_POOL_H
+#define TRIAL_POOL_H
+
+#include "arena.hpp"
+
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Threads of the speculative line search, each with its own arena
+ *
+ * run() hands task(1) .. task(count - 1) to the threads, does task(0) on
+ * the calling thread and returns when all are done, rethrowing the first
+ * exception raised. A pool outlives the solves it serves when the caller
+ * passes it in LBFGSControl, so its threads and arenas stay warm.
+ */
+class TrialPool
+{
+public:
+    explicit TrialPool(int size);    // size threads besides the caller
+    ~TrialPool();
+
+    int size() const { return int(threads.size()); }
+
+    // Arena of thread t (1 .. size)
+    FrameArena& arena(int t) { return arenas[t - 1]; }
+
+    // Tasks 0 .. count - 1, count at most size() + 1
+    void run(const std::function<void(int)>& task, int count);
+
+private:
+    std::vector<std::thread> threads;
+    std::unique_ptr<FrameArena[]> arenas;
+    std::mutex mutex;
+    std::condition_variable start;
+    std::condition_variable done;
+    const std::function<void(int)>* current = nullptr;
+    int current_count = 0;
+    long round = 0;
+    int pending = 0;
+    bool stopping = false;
+    std::exception_ptr failure;
+
+    void serve(int t);
+
+    TrialPool(const TrialPool&);
+    TrialPool& operator=(const TrialPool&);
+};
+
+#endif // TRIAL_POOL_H
@@ -0,0 +1,99 @@
+#ifndef VEC_H
+#define VEC_H
+
+#include <cmath>
+
+/**
+ * @brief Fixed-size vector stored inline (no heap allocation)
+ *
+ * Meant for small geometric quantities (points, normals, index tuples)
+ * where Vector<T> would pay a new/delete per object.
+ */
+template <typename T, int N>
+struct Vec
+{
+    T values[N];
+
+    static constexpr int dimension = N;
+
+    // Element access (1-based indexing, as Vector<T>)
+    constexpr T& operator()(int i) { return values[i - 1]; }
+    constexpr const T& operator()(int i) const { return values[i - 1]; }
+};
+
+typedef Vec<double, 3> Vec3d;
+
+/* ===================== IMPLEMENTATION ===================== */
+
+template <typename T, int N>
+constexpr Vec<T, N> operator+(const Vec<T, N>& a, const Vec<T, N>& b)
+{
+    Vec<T, N> c{};
+    for (int i = 0; i < N; i++)
+        c.values[i] = a.values[i] + b.values[i];
+    return c;
+}
+
+template <typename T, int N>
+constexpr Vec<T, N> operator-(const Vec<T, N>& a, const Vec<T, N>& b)
+{
+    Vec<T, N> c{};
+    for (int i = 0; i < N; i++)
+        c.values[i] = a.values[i] - b.values[i];
+    return c;
+}
+
+template <typename T, int N>
+constexpr Vec<T, N> operator*(const Vec<T, N>& a, T f)
+{
+    Vec<T, N> c{};
+    for (int i = 0; i < N; i++)
+        c.values[i] = a.values[i] * f;
+    return c;
+}
+
+template <typename T, int N>
+constexpr Vec<T, N> operator/(const Vec<T, N>& a, T f)
+{
+    Vec<T, N> c{};
+    for (int i = 0; i < N; i++)
+        c.values[i] = a.values[i] / f;
+    return c;
+}
+
+// Dot product
+template <typename T, int N>
+constexpr T dot(const Vec<T, N>& a, const Vec<T, N>& b)
+{
+    T result = T(0);
+    for (int i = 0; i < N; i++)
+        result += a.values[i] * b.values[i];
+    return result;
+}
+
+// Cross product (3D only)
+template <typename T>
+constexpr Vec<T, 3> cross(const Vec<T, 3>& a, const Vec<T, 3>& b)
+{
+    return Vec<T, 3>{{
+        a.values[1] * b.values[2] - a.values[2] * b.values[1],
+        a.values[2] * b.values[0] - a.values[0] * b.values[2],
+        a.values[0] * b.values[1] - a.values[1] * b.values[0]
+    }};
+}
+
+// Norm
+template <typename T, int N>
+inline double norm(const Vec<T, N>& a)
+{
+    return std::sqrt(dot(a, a));
+}
+
+// Unit vector along a (a must be non-zero)
+template <typename T, int N>
+inline Vec<T, N> normalize(const Vec<T, N>& a)
+{
+    return a / T(norm(a));
+}
+
+#endif // VEC_H
@@ -3,7 +3,9 @@
 
 #include <iostream>
 #include <cmath>
+#include <type_traits>
 #include "./matrix.hpp"
+#include "./arena.hpp"
 
 template <typename T>
 class Vector
@@ -11,6 +13,7 @@ class Vector
 public:
     int dimension;
     T* values;
+    bool pooled;           // storage owned by an arena (see arena.hpp)
 
     // Constructors
     Vector();
@@ -33,7 +36,7 @@ public:
     Vector<T> concatenate(const Vector<T>&);
     Matrix toMatrix(int rows, int cols) const;
 
-    T operator*(const Vector<T>&);                   // dot product
+    T operator*(const Vector<T>&) const;             // dot product
     T& operator()(int) const;                        // 1-based indexing
     Vector<T> operator()(int, int) const;            // subvector
 
@@ -43,31 +46,63 @@ public:
 
     // Norm
     double norm() const;
+
+private:
+    void allocate(int d);      // set dimension and storage (uninitialized)
+    void release();            // give storage back
 };
 
 /* ===================== IMPLEMENTATION ===================== */
 
+// Storage: from the thread's active arena for plain element types,
+// from the heap otherwise
+template <typename T>
+void Vector<T>::allocate(int d)
+{
+    dimension = d;
+    FrameArena* arena = activeArena();
+
+    if (dimension <= 0)
+    {
+        values = nullptr;
+        pooled = false;
+    }
+    else if (arena && std::is_trivially_destructible<T>::value)
+    {
+        values = static_cast<T*>(arena->allocate(dimension * sizeof(T)));
+        pooled = true;
+    }
+    else
+    {
+        values = new T[dimension];
+        pooled = false;
+    }
+}
+
+template <typename T>
+void Vector<T>::release()
+{
+    if (!pooled)
+        delete[] values;
+    values = nullptr;
+}
+
 // Constructors
 template <typename T>
-Vector<T>::Vector() : dimension(0), values(nullptr) {}
+Vector<T>::Vector() : dimension(0), values(nullptr), pooled(false) {}
 
 template <typename T>
-Vector<T>::Vector(int d, T v) : dimension(d)
+Vector<T>::Vector(int d, T v)
 {
-    values = new T[dimension];
+    allocate(d);
     for (int i = 0; i < dimension; i++)
         values[i] = v;
 }
 
 template <typename T>
-Vector<T>::Vector(const Vector<T>& V) : dimension(V.dimension)
+Vector<T>::Vector(const Vector<T>& V)
 {
-    if (dimension <= 0)
-    {
-        values = nullptr;
-        return;
-    }
-    values = new T[dimension];
+    allocate(V.dimension);
     for (int i = 0; i < dimension; i++)
         values[i] = V.values[i];
 }
@@ -76,20 +111,22 @@ Vector<T>::Vector(const Vector<T>& V) : dimension(V.dimension)
 template <typename T>
 Vector<T>::~Vector()
 {
-    delete[] values;
+    release();
 }
 
-// Assignment
+// Assignment (storage is reused when the dimensions match)
 template <typename T>
 Vector<T>& Vector<T>::operator=(const Vector<T>& V)
 {
     if (this == &V)
         return *this;
 
-    dimension = V.dimension;
-    delete[] values;
+    if (dimension != V.dimension)
+    {
+        release();
+        allocate(V.dimension);
+    }
 
-    values = new T[dimension];
     for (int i = 0; i < dimension; i++)
         values[i] = V.values[i];
 
@@ -241,7 +278,7 @@ Vector<T> Vector<T>::operator^(const Vector<T>& V)
 
 // Dot product
 template <typename T>
-T Vector<T>::operator*(const Vector<T>& V)
+T Vector<T>::operator*(const Vector<T>& V) const
 {
     T result = T(0);
     for (int i = 0; i < dimension; i++)
@@ -0,0 +1,92 @@
+#include "../include/active_domain.hpp"
+#include "../include/matrix.hpp"
+#include "../include/vector.hpp"
+
+#include <cstdlib>
+#include <iostream>
+
+// Build the compact active-pixel index and its neighbour tables
+ActiveDomain buildActiveDomain(const Matrix& mask)
+{
+    ActiveDomain domain;
+    domain.rows = mask.rows;
+    domain.cols = mask.cols;
+    domain.index = Vector<int>(mask.rows * mask.cols, -1);
+
+    int count = 0;
+    for (int i = 0; i < mask.rows; i++)
+        for (int j = 0; j < mask.cols; j++)
+            if (mask.values[i][j] != 0.0)
+                domain.index.values[i * mask.cols + j] = count++;
+
+    if (count == 0)
+    {
+        std::cerr << "Error: mask has no active pixel.\n";
+        std::exit(1);
+    }
+
+    domain.num_active = count;
+    domain.row   = Vector<int>(count);
+    domain.col   = Vector<int>(count);
+    domain.down  = Vector<int>(count, -1);
+    domain.right = Vector<int>(count, -1);
+
+    for (int i = 0; i < mask.rows; i++)
+    {
+        for (int j = 0; j < mask.cols; j++)
+        {
+            int k = domain.index.values[i * mask.cols + j];
+            if (k < 0)
+                continue;
+
+            domain.row.values[k] = i;
+            domain.col.values[k] = j;
+
+            if (i + 1 < mask.rows)
+                domain.down.values[k] = domain.index.values[(i + 1) * mask.cols + j];
+            if (j + 1 < mask.cols)
+                domain.right.values[k] = domain.index.values[i * mask.cols + j + 1];
+        }
+    }
+
+    return domain;
+}
+
+// Foreground mask: every pixel that differs from the background level
+Matrix backgroundMask(const Matrix& image, double background)
+{
+    Matrix mask(image.rows, image.cols);
+    for (int i = 0; i < image.rows; i++)
+        for (int j = 0; j < image.cols; j++)
+            mask.values[i][j] = (image.values[i][j] != background) ? 1.0 : 0.0;
+
+    return mask;
+}
+
+// Frame matrix → compact vector (one block per stacked frame, e.g. p then q)
+Vector<double> gatherFromFrame(const Matrix& M, const ActiveDomain& domain)
+{
+    int blocks = M.rows / domain.rows;
+    Vector<double> v(blocks * domain.num_active);
+
+    for (int b = 0; b < blocks; b++)
+        for (int k = 0; k < domain.num_active; k++)
+            v.values[b * domain.num_active + k] =
+                M.values[b * domain.rows + domain.row.values[k]][domain.col.values[k]];
+
+    return v;
+}
+
+// Compact vector → frame matrix, inactive pixels set to fill
+Matrix scatterToFrame(const Vector<double>& v, const ActiveDomain& domain, double fill)
+{
+    int blocks = v.dimension / domain.num_active;
+    Matrix M(blocks * domain.rows, domain.cols, fill);
+
+    for (int b = 0; b < blocks; b++)
+        for (int k = 0; k < domain.num_active; k++)
+            M.values[b * domain.rows + domain.row.values[k]][domain.col.values[k]] =
+                v.values[b * domain.num_active + k];
+
+    return M;
+}
@@ -0,0 +1,141 @@
+#include "../include/arena.hpp"
+
+#include <cstdlib>
+#include <new>
+
+static const size_t alignment = 64;
+
+static thread_local FrameArena* active_arena = nullptr;
+
+FrameArena::FrameArena(size_t bytes)
+{
+    current = 0;
+    chunk_bytes = bytes;
+    in_use = 0;
+    peak = 0;
+    system_allocations = 0;
+}
+
+FrameArena::~FrameArena()
+{
+    for (size_t i = 0; i < chunks.size(); i++)
+        std::free(chunks[i].data);
+}
+
+void* FrameArena::allocate(size_t bytes)
+{
+    bytes = (bytes + alignment - 1) / alignment * alignment;
+
+    // Move to the next chunk that has room, or obtain a new one
+    while (current < chunks.size() && chunks[current].used + bytes > chunks[current].size)
+        current++;
+
+    if (current == chunks.size())
+    {
+        Chunk chunk;
+        chunk.size = bytes > chunk_bytes ? bytes : chunk_bytes;
+        chunk.used = 0;
+        chunk.data = static_cast<char*>(std::aligned_alloc(alignment, chunk.size));
+
+        if (!chunk.data)
+            throw std::bad_alloc();
+
+        chunks.push_back(chunk);
+        system_allocations++;
+    }
+
+    Chunk& chunk = chunks[current];
+    void* block = chunk.data + chunk.used;
+    chunk.used += bytes;
+
+    in_use += bytes;
+    if (in_use > peak)
+        peak = in_use;
+
+    return block;
+}
+
+FrameArena::Mark FrameArena::mark() const
+{
+    Mark m;
+    m.chunk = current;
+    m.used = current < chunks.size() ? chunks[current].used : 0;
+    return m;
+}
+
+void FrameArena::rewind(const Mark& m)
+{
+    for (size_t i = m.chunk + 1; i < chunks.size(); i++)
+    {
+        in_use -= chunks[i].used;
+        chunks[i].used = 0;
+    }
+
+    if (m.chunk < chunks.size())
+    {
+        in_use -= chunks[m.chunk].used - m.used;
+        chunks[m.chunk].used = m.used;
+    }
+
+    current = m.chunk;
+}
+
+void FrameArena::reset()
+{
+    // Merge the chunks so the next frame fits in a single block
+    if (chunks.size() > 1)
+    {
+        size_t total = capacity();
+
+        for (size_t i = 0; i < chunks.size(); i++)
+            std::free(chunks[i].data);
+        chunks.clear();
+
+        chunk_bytes = total;
+    }
+
+    for (size_t i = 0; i < chunks.size(); i++)
+        chunks[i].used = 0;
+
+    current = 0;
+    in_use = 0;
+}
+
+size_t FrameArena::bytesInUse() const
+{
+    return in_use;
+}
+
+size_t FrameArena::highWaterMark() const
+{
+    return peak;
+}
+
+size_t FrameArena::capacity() const
+{
+    size_t total = 0;
+    for (size_t i = 0; i < chunks.size(); i++)
+        total += chunks[i].size;
+    return total;
+}
+
+long FrameArena::systemAllocations() const
+{
+    return system_allocations;
+}
+
+FrameArena* activeArena()
+{
+    return active_arena;
+}
+
+ArenaScope::ArenaScope(FrameArena& arena)
+{
+    previous = active_arena;
+    active_arena = &arena;
+}
+
+ArenaScope::~ArenaScope()
+{
+    active_arena = previous;
+}
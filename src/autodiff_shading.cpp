@@ -0,0 +1,111 @@
+// Shading energy of the first stage written once, as stencil terms, with
+// its gradient generated by forward-mode differentiation (autodiff.hpp)
+
+#include "../include/autodiff.hpp"
+#include "../include/reflectance.hpp"
+#include "../include/vector.hpp"
+#include "../include/globals.hpp"
+#include "../include/perf_counters.hpp"
+
+// Data term at a pixel: (I - R(p, q))²
+template <typename Model, typename Image>
+struct ShadingDataTerm
+{
+    static constexpr int size = 2;
+    static constexpr StencilTap taps[size] = { { 0, 0, 0 }, { 1, 0, 0 } };
+
+    const Image* image;
+    Model model;
+    double weight;
+
+    template <typename T>
+    T operator()(const T* u, int i, int j) const
+    {
+        return weight * square(greyLevel(*image, i, j) - modelRadiance(model, u[0], u[1]));
+    }
+};
+
+// Integrability and smoothness on the forward differences of p and q
+struct ShadingRegularizerTerm
+{
+    static constexpr int size = 6;
+    static constexpr StencilTap taps[size] = {
+        { 0, 0, 0 }, { 0, 0, 1 }, { 0, 1, 0 },     // p, p right, p down
+        { 1, 0, 0 }, { 1, 0, 1 }, { 1, 1, 0 }      // q, q right, q down
+    };
+
+    double integrability;
+    double smoothness;
+
+    template <typename T>
+    T operator()(const T* u, int, int) const
+    {
+        const T& p = u[0];
+        const T& q = u[3];
+
+        return integrability * square(u[1] - p - u[5] + q)
+             + smoothness * (square(u[2] - p) + square(u[1] - p) +
+                             square(u[4] - q) + square(u[5] - q));
+    }
+};
+
+template <typename Model, typename Image>
+static double shadingEnergy(const Vector<double>& x, const ShadingData<Model, Image>& data,
+                            Vector<double>* gradient)
+{
+    const Image& image = *data.image;
+    const EnergyWeights& weights = data.weights;
+
+    ShadingDataTerm<Model, Image> data_term = { &image, data.model, weights.step_size * weights.step_size };
+    ShadingRegularizerTerm regularizer = { weights.lambda_internal, weights.lambda_csmo };
+
+    return stencilEnergy(data_term, x, image.rows, image.cols, gradient)
+         + stencilEnergy(regularizer, x, image.rows, image.cols, gradient);
+}
+
+template <typename Model, typename Image>
+double autodiffShadingObjective(const Vector<double>& x, const ShadingData<Model, Image>& data)
+{
+    PerfScope perf("autodiff objective", long(data.image->rows) * data.image->cols);
+    return shadingEnergy(x, data, nullptr);
+}
+
+template <typename Model, typename Image>
+Vector<double> autodiffShadingGradient(const Vector<double>& x, const ShadingData<Model, Image>& data)
+{
+    PerfScope perf("autodiff gradient", long(data.image->rows) * data.image->cols);
+
+    Vector<double> gradient(x.dimension, 0.0);
+    shadingEnergy(x, data, &gradient);
+    return gradient;
+}
+
+template double autodiffShadingObjective(const Vector<double>&, const ShadingData<FrontalLambertian>&);
+template double autodiffShadingObjective(const Vector<double>&, const ShadingData<Lambertian>&);
+template double autodiffShadingObjective(const Vector<double>&, const ShadingData<LommelSeeliger>&);
+template double autodiffShadingObjective(const Vector<double>&, const ShadingData<HapkeLite>&);
+
+template double autodiffShadingObjective(const Vector<double>&, const ShadingData<FrontalLambertian, SensorImage<uint8_t>>&);
+template double autodiffShadingObjective(const Vector<double>&, const ShadingData<Lambertian, SensorImage<uint8_t>>&);
+template double autodiffShadingObjective(const Vector<double>&, const ShadingData<LommelSeeliger, SensorImage<uint8_t>>&);
+template double autodiffShadingObjective(const Vector<double>&, const ShadingData<HapkeLite, SensorImage<uint8_t>>&);
+
+template double autodiffShadingObjective(const Vector<double>&, const ShadingData<FrontalLambertian, SensorImage<uint16_t>>&);
+template double autodiffShadingObjective(const Vector<double>&, const ShadingData<Lambertian, SensorImage<uint16_t>>&);
+template double autodiffShadingObjective(const Vector<double>&, const ShadingData<LommelSeeliger, SensorImage<uint16_t>>&);
+template double autodiffShadingObjective(const Vector<double>&, const ShadingData<HapkeLite, SensorImage<uint16_t>>&);
+
+template Vector<double> autodiffShadingGradient(const Vector<double>&, const ShadingData<FrontalLambertian>&);
+template Vector<double> autodiffShadingGradient(const Vector<double>&, const ShadingData<Lambertian>&);
+template Vector<double> autodiffShadingGradient(const Vector<double>&, const ShadingData<LommelSeeliger>&);
+template Vector<double> autodiffShadingGradient(const Vector<double>&, const ShadingData<HapkeLite>&);
+
+template Vector<double> autodiffShadingGradient(const Vector<double>&, const ShadingData<FrontalLambertian, SensorImage<uint8_t>>&);
+template Vector<double> autodiffShadingGradient(const Vector<double>&, const ShadingData<Lambertian, SensorImage<uint8_t>>&);
+template Vector<double> autodiffShadingGradient(const Vector<double>&, const ShadingData<LommelSeeliger, SensorImage<uint8_t>>&);
+template Vector<double> autodiffShadingGradient(const Vector<double>&, const ShadingData<HapkeLite, SensorImage<uint8_t>>&);
+
+template Vector<double> autodiffShadingGradient(const Vector<double>&, const ShadingData<FrontalLambertian, SensorImage<uint16_t>>&);
+template Vector<double> autodiffShadingGradient(const Vector<double>&, const ShadingData<Lambertian, SensorImage<uint16_t>>&);
+template Vector<double> autodiffShadingGradient(const Vector<double>&, const ShadingData<LommelSeeliger, SensorImage<uint16_t>>&);
+template Vector<double> autodiffShadingGradient(const Vector<double>&, const ShadingData<HapkeLite, SensorImage<uint16_t>>&);
@@ -0,0 +1,248 @@
+// Calibration of solver settings per host and image size
+
+#include "../include/autotune.hpp"
+#include "../include/reflectance.hpp"
+#include "../include/matrix.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+static std::string tuningFile()
+{
+    const char* file = std::getenv("SFS_TUNING_FILE");
+    if (file && *file)
+        return file;
+
+    const char* home = std::getenv("HOME");
+    return std::string(home ? home : ".") + "/.cache/sfs-tuning.txt";
+}
+
+// Host name and core count: a setting measured on one machine says
+// nothing of another
+static std::string hostKey()
+{
+    char name[256] = "unknown";
+    gethostname(name, sizeof(name) - 1);
+    name[sizeof(name) - 1] = '\0';
+
+    return std::string(name) + "/" + std::to_string(std::thread::hardware_concurrency());
+}
+
+int sizeClass(int rows, int cols)
+{
+    long pixels = long(rows) * cols;
+    int size_class = 0;
+    while (pixels > 1)
+    {
+        pixels /= 2;
+        size_class++;
+    }
+    return size_class;
+}
+
+bool loadTuning(int size_class, TunedSettings& settings)
+{
+    std::ifstream file(tuningFile());
+    std::string host = hostKey();
+    std::string line;
+    bool found = false;
+
+    // The last entry of a host and class wins
+    while (std::getline(file, line))
+    {
+        std::istringstream fields(line);
+        std::string entry_host;
+        int entry_class, interleaved;
+        TunedSettings entry;
+
+        if (fields >> entry_host >> entry_class >> entry.lbfgs_memory >> entry.line_threads
+                   >> interleaved >> entry.seconds &&
+            entry_host == host && entry_class == size_class &&
+            entry.lbfgs_memory >= 1 && entry.line_threads >= 1)
+        {
+            entry.interleaved = interleaved != 0;
+            settings = entry;
+            found = true;
+        }
+    }
+
+    return found;
+}
+
+void saveTuning(int size_class, const TunedSettings& settings)
+{
+    std::string path = tuningFile();
+    std::string host = hostKey();
+
+    // Keep the other hosts and classes
+    std::vector<std::string> kept;
+    {
+        std::ifstream file(path);
+        std::string line;
+        while (std::getline(file, line))
+        {
+            std::istringstream fields(line);
+            std::string entry_host;
+            int entry_class;
+
+            if (fields >> entry_host >> entry_class && entry_host == host && entry_class == size_class)
+                continue;
+            kept.push_back(line);
+        }
+    }
+
+    std::error_code error;
+    std::filesystem::path parent = std::filesystem::path(path).parent_path();
+    if (!parent.empty())
+        std::filesystem::create_directories(parent, error);
+
+    // Unique temporary next to the file, renamed into place
+    std::vector<char> name(path.begin(), path.end());
+    const char suffix[] = ".tmp.XXXXXX";
+    name.insert(name.end(), suffix, suffix + sizeof(suffix));
+
+    int fd = mkstemp(name.data());
+    std::string temporary = name.data();
+    if (fd < 0)
+    {
+        std::cerr << "Error: unable to write tuning file " << path << ".\n";
+        std::exit(1);
+    }
+    fchmod(fd, 0644);
+    close(fd);
+
+    std::ofstream file(temporary);
+
+    for (const std::string& line : kept)
+        file << line << "\n";
+
+    file << host << " " << size_class << " " << settings.lbfgs_memory << " "
+         << settings.line_threads << " " << int(settings.interleaved) << " "
+         << settings.seconds << "\n";
+
+    file.close();
+
+    if (!file || std::rename(temporary.c_str(), path.c_str()) != 0)
+    {
+        std::remove(temporary.c_str());
+        std::cerr << "Error: unable to write tuning file " << path << ".\n";
+        std::exit(1);
+    }
+}
+
+Matrix syntheticImage(int rows, int cols)
+{
+    // Height: a few Gaussian bumps and a gentle ripple
+    Matrix height(rows, cols);
+    const double bumps[4][4] = {
+        { 0.30, 0.35, 0.12, 18.0 },
+        { 0.65, 0.60, 0.18, -14.0 },
+        { 0.40, 0.75, 0.08, 9.0 },
+        { 0.75, 0.25, 0.10, 11.0 }
+    };
+
+    for (int i = 0; i < rows; i++)
+    {
+        for (int j = 0; j < cols; j++)
+        {
+            double y = double(i) / rows;
+            double x = double(j) / cols;
+            double h = 2.0 * std::sin(12.0 * x) * std::cos(9.0 * y);
+
+            for (const auto& bump : bumps)
+            {
+                double r2 = (y - bump[0]) * (y - bump[0]) + (x - bump[1]) * (x - bump[1]);
+                h += bump[3] * std::exp(-r2 / (2.0 * bump[2] * bump[2]));
+            }
+
+            height.values[i][j] = h;
+        }
+    }
+
+    Matrix image(rows, cols);
+    FrontalLambertian model;
+
+    for (int i = 0; i < rows; i++)
+    {
+        for (int j = 0; j < cols; j++)
+        {
+            double p = i + 1 < rows ? height.values[i + 1][j] - height.values[i][j] : 0.0;
+            double q = j + 1 < cols ? height.values[i][j + 1] - height.values[i][j] : 0.0;
+            image.values[i][j] = model.radiance(p, q);
+        }
+    }
+
+    return image;
+}
+
+TunedSettings autotune(
+    const Matrix& image,
+    const std::function<double(const TunedSettings&, const Matrix&)>& measure
+)
+{
+    int cores = std::max(1u, std::thread::hardware_concurrency());
+
+    std::vector<int> memories = { 3, 5, 8, 12, 20 };
+    std::vector<int> threads;
+    for (int t = 1; t <= std::min(cores, 8); t *= 2)
+        threads.push_back(t);
+
+    TunedSettings best;
+    best.seconds = measure(best, image);
+
+    auto report = [](const char* what, const TunedSettings& settings)
+    {
+        std::cout << "Autotune " << what << ": memory " << settings.lbfgs_memory
+                  << ", line threads " << settings.line_threads
+                  << ", interleaved " << settings.interleaved
+                  << ": " << settings.seconds << " s\n";
+    };
+    report("default", best);
+
+    auto consider = [&](TunedSettings candidate)
+    {
+        candidate.seconds = measure(candidate, image);
+        report("candidate", candidate);
+        if (candidate.seconds < best.seconds)
+            best = candidate;
+    };
+
+    // Layout, then history depth, then threads, each from the best so far
+    TunedSettings candidate = best;
+    candidate.interleaved = !best.interleaved;
+    consider(candidate);
+
+    int memory_base = best.lbfgs_memory;
+    for (int memory : memories)
+    {
+        if (memory == memory_base)
+            continue;
+        candidate = best;
+        candidate.lbfgs_memory = memory;
+        consider(candidate);
+    }
+
+    int threads_base = best.line_threads;
+    for (int t : threads)
+    {
+        if (t == threads_base)
+            continue;
+        candidate = best;
+        candidate.line_threads = t;
+        consider(candidate);
+    }
+
+    report("best", best);
+    return best;
+}
@@ -0,0 +1,256 @@
+#include "../include/blas1.hpp"
+#include "../include/perf_counters.hpp"
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+// Two doubles processed together (one SSE2/NEON register, the baseline of
+// the targets we build for), unaligned loads and stores, and free to alias
+// plain double arrays
+typedef double Lanes __attribute__((vector_size(2 * sizeof(double)), aligned(sizeof(double)), may_alias));
+
+static const int lanes = 2;
+static const int block_size = 4096;           // elements per partial sum
+static const int min_per_thread = 1 << 18;    // below this, one thread is faster
+
+struct Sums
+{
+    double first;
+    double second;
+};
+
+static inline Lanes load(const double* p)
+{
+    return *reinterpret_cast<const Lanes*>(p);
+}
+
+static inline void store(double* p, Lanes v)
+{
+    *reinterpret_cast<Lanes*>(p) = v;
+}
+
+static inline double laneSum(Lanes v)
+{
+    return v[0] + v[1];
+}
+
+// Apply kernel(begin, end) to every block and add the block sums in block
+// order, on up to threads threads, each taking a contiguous run of blocks
+template <typename Kernel>
+static Sums runBlocks(int n, int threads, const Kernel& kernel)
+{
+    int blocks = (n + block_size - 1) / block_size;
+    threads = std::min(threads, n / min_per_thread);
+
+    Sums total = { 0.0, 0.0 };
+
+    if (threads <= 1)
+    {
+        for (int b = 0; b < blocks; b++)
+        {
+            Sums part = kernel(b * block_size, std::min(n, (b + 1) * block_size));
+            total.first += part.first;
+            total.second += part.second;
+        }
+        return total;
+    }
+
+    std::vector<Sums> partial(blocks);
+    std::vector<std::thread> pool;
+
+    for (int t = 0; t < threads; t++)
+    {
+        int first = int(long(blocks) * t / threads);
+        int last = int(long(blocks) * (t + 1) / threads);
+
+        pool.emplace_back([&, first, last]()
+        {
+            for (int b = first; b < last; b++)
+                partial[b] = kernel(b * block_size, std::min(n, (b + 1) * block_size));
+        });
+    }
+
+    for (std::thread& thread : pool)
+        thread.join();
+
+    for (int b = 0; b < blocks; b++)
+    {
+        total.first += partial[b].first;
+        total.second += partial[b].second;
+    }
+
+    return total;
+}
+
+double dot(int n, const double* x, const double* y, int threads)
+{
+    PerfScope perf("blas1 dot", n, threads > 1);
+
+    return runBlocks(n, threads, [=](int begin, int end)
+    {
+        Lanes sum = { 0.0, 0.0 };
+        int i = begin;
+        for (; i + lanes <= end; i += lanes)
+            sum += load(x + i) * load(y + i);
+
+        Sums part = { laneSum(sum), 0.0 };
+        for (; i < end; i++)
+            part.first += x[i] * y[i];
+        return part;
+    }).first;
+}
+
+void dot2(int n, const double* x, const double* a, const double* b,
+          double& xa, double& xb, int threads)
+{
+    PerfScope perf("blas1 dot2", n, threads > 1);
+
+    Sums sums = runBlocks(n, threads, [=](int begin, int end)
+    {
+        Lanes sum_a = { 0.0, 0.0 };
+        Lanes sum_b = { 0.0, 0.0 };
+        int i = begin;
+        for (; i + lanes <= end; i += lanes)
+        {
+            Lanes xi = load(x + i);
+            sum_a += xi * load(a + i);
+            sum_b += xi * load(b + i);
+        }
+
+        Sums part = { laneSum(sum_a), laneSum(sum_b) };
+        for (; i < end; i++)
+        {
+            part.first += x[i] * a[i];
+            part.second += x[i] * b[i];
+        }
+        return part;
+    });
+
+    xa = sums.first;
+    xb = sums.second;
+}
+
+void axpy(int n, double a, const double* x, double* y, int threads)
+{
+    axpyDot(n, a, x, y, y, nullptr, threads);
+}
+
+double scaleDot(int n, double a, const double* x, double* z, const double* w, int threads)
+{
+    PerfScope perf("blas1 scale dot", n, threads > 1);
+
+    return runBlocks(n, threads, [=](int begin, int end)
+    {
+        Lanes sum = { 0.0, 0.0 };
+        int i = begin;
+        for (; i + lanes <= end; i += lanes)
+        {
+            Lanes zi = a * load(x + i);
+            store(z + i, zi);
+            if (w)
+                sum += load(w + i) * zi;
+        }
+
+        Sums part = { laneSum(sum), 0.0 };
+        for (; i < end; i++)
+        {
+            z[i] = a * x[i];
+            if (w)
+                part.first += w[i] * z[i];
+        }
+        return part;
+    }).first;
+}
+
+double axpyDot(int n, double a, const double* x, const double* y, double* z,
+               const double* w, int threads)
+{
+    PerfScope perf("blas1 axpy dot", n, threads > 1);
+
+    return runBlocks(n, threads, [=](int begin, int end)
+    {
+        Lanes sum = { 0.0, 0.0 };
+        int i = begin;
+        for (; i + lanes <= end; i += lanes)
+        {
+            Lanes zi = load(y + i) + a * load(x + i);
+            store(z + i, zi);
+            if (w)
+                sum += load(w + i) * zi;
+        }
+
+        Sums part = { laneSum(sum), 0.0 };
+        for (; i < end; i++)
+        {
+            z[i] = y[i] + a * x[i];
+            if (w)
+                part.first += w[i] * z[i];
+        }
+        return part;
+    }).first;
+}
+
+double axpyScaleDot(int n, double a, const double* x, const double* y, double b,
+                    double* z, const double* w, int threads)
+{
+    PerfScope perf("blas1 axpy scale dot", n, threads > 1);
+
+    return runBlocks(n, threads, [=](int begin, int end)
+    {
+        Lanes sum = { 0.0, 0.0 };
+        int i = begin;
+        for (; i + lanes <= end; i += lanes)
+        {
+            Lanes zi = b * (load(y + i) + a * load(x + i));
+            store(z + i, zi);
+            if (w)
+                sum += load(w + i) * zi;
+        }
+
+        Sums part = { laneSum(sum), 0.0 };
+        for (; i < end; i++)
+        {
+            z[i] = b * (y[i] + a * x[i]);
+            if (w)
+                part.first += w[i] * z[i];
+        }
+        return part;
+    }).first;
+}
+
+void differenceDots(int n, const double* x0, const double* x1,
+                    const double* g0, const double* g1, double* s, double* y,
+                    double& sy, double& yy, int threads)
+{
+    PerfScope perf("blas1 difference dots", n, threads > 1);
+
+    Sums sums = runBlocks(n, threads, [=](int begin, int end)
+    {
+        Lanes sum_sy = { 0.0, 0.0 };
+        Lanes sum_yy = { 0.0, 0.0 };
+        int i = begin;
+        for (; i + lanes <= end; i += lanes)
+        {
+            Lanes si = load(x1 + i) - load(x0 + i);
+            Lanes yi = load(g1 + i) - load(g0 + i);
+            store(s + i, si);
+            store(y + i, yi);
+            sum_sy += si * yi;
+            sum_yy += yi * yi;
+        }
+
+        Sums part = { laneSum(sum_sy), laneSum(sum_yy) };
+        for (; i < end; i++)
+        {
+            s[i] = x1[i] - x0[i];
+            y[i] = g1[i] - g0[i];
+            part.first += s[i] * y[i];
+            part.second += y[i] * y[i];
+        }
+        return part;
+    });
+
+    sy = sums.first;
+    yy = sums.second;
+}
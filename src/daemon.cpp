@@ -0,0 +1,504 @@
+// Reconstruction server on a Unix domain socket
+
+#include "../include/daemon.hpp"
+#include "../include/sfs.hpp"
+#include "../include/bounded_queue.hpp"
+#include "../include/image_factory.hpp"
+#include "../include/lbfgs.hpp"
+#include "../include/arena.hpp"
+#include "../include/trial_pool.hpp"
+#include "../include/matrix.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cerrno>
+#include <climits>
+#include <condition_variable>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Largest image side and path accepted from a client
+static const int daemon_max_side = 1 << 15;
+static const long daemon_max_pixels = 1L << 26;   // 512 MB of grey levels
+static const uint32_t daemon_max_path = 4096;
+
+static std::atomic<bool> stop_requested(false);
+
+static void onSignal(int)
+{
+    stop_requested = true;
+}
+
+// Read / write exactly size bytes; false on end of stream or error
+static bool readAll(int fd, void* data, size_t size)
+{
+    char* bytes = static_cast<char*>(data);
+    while (size > 0)
+    {
+        ssize_t n = recv(fd, bytes, size, 0);
+        if (n <= 0)
+            return false;
+        bytes += n;
+        size -= n;
+    }
+    return true;
+}
+
+static bool writeAll(int fd, const void* data, size_t size)
+{
+    const char* bytes = static_cast<const char*>(data);
+    while (size > 0)
+    {
+        ssize_t n = send(fd, bytes, size, MSG_NOSIGNAL);
+        if (n <= 0)
+            return false;
+        bytes += n;
+        size -= n;
+    }
+    return true;
+}
+
+static bool unixAddress(const std::string& path, sockaddr_un& address)
+{
+    if (path.size() >= sizeof(address.sun_path))
+        return false;
+
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    std::strcpy(address.sun_path, path.c_str());
+    return true;
+}
+
+struct Job;
+
+// A client connection and its jobs still queued or running
+struct Connection
+{
+    int fd;
+
+    std::mutex write_mutex;
+    std::mutex jobs_mutex;
+    std::map<uint64_t, std::shared_ptr<Job>> jobs;
+
+    explicit Connection(int fd) : fd(fd) {}
+    ~Connection() { close(fd); }
+
+    // Send a reply and its payload as one message
+    void reply(const DaemonReply& header, const void* payload)
+    {
+        std::lock_guard<std::mutex> lock(write_mutex);
+        if (writeAll(fd, &header, sizeof(header)) && header.payload_bytes > 0)
+            writeAll(fd, payload, header.payload_bytes);
+    }
+
+    void cancelAll();
+};
+
+struct Job
+{
+    uint64_t id;
+    std::shared_ptr<Connection> connection;
+    sfs_params params;
+    uint32_t output;
+    double mesh_tolerance;
+    Matrix image;              // buffer jobs
+    std::string path;          // path jobs
+    std::atomic<bool> cancel;
+
+    Job() : cancel(false) {}
+};
+
+void Connection::cancelAll()
+{
+    std::lock_guard<std::mutex> lock(jobs_mutex);
+    for (auto& entry : jobs)
+        entry.second->cancel = true;
+}
+
+typedef BoundedQueue<std::shared_ptr<Job>> JobQueue;
+
+// Solve one job and answer it
+static void runJob(Job& job, FrameArena& workspace, std::unique_ptr<TrialPool>& trial_pool)
+{
+    DaemonReply reply;
+    std::memset(&reply, 0, sizeof(reply));
+    reply.magic = daemon_reply_magic;
+    reply.job = job.id;
+    reply.status = SFS_CANCELLED;
+
+    Matrix height;
+    std::string mesh;
+    const void* payload = nullptr;
+
+    // A bad request fails its own job only: nothing here may exit or throw
+    try
+    {
+        Matrix image;
+        bool readable = true;
+
+        if (job.cancel)
+        {
+            readable = false;
+        }
+        else if (!job.path.empty())
+        {
+            std::string error;
+            readable = readCsvMatrix(job.path.c_str(), image, error, daemon_max_pixels) &&
+                       image.rows <= daemon_max_side && image.cols <= daemon_max_side;
+            if (!readable)
+                reply.status = SFS_INVALID_ARGUMENT;
+        }
+        else
+        {
+            image = std::move(job.image);
+        }
+
+        if (readable)
+        {
+            SfsContext context;
+            context.cancel = &job.cancel;
+            context.workspace = &workspace;
+
+            // Line-search threads, grown to the largest valid job seen so far
+            int helpers = job.params.line_threads - 1;
+            if (helpers > 0 && helpers < SFS_MAX_LINE_THREADS &&
+                (!trial_pool || trial_pool->size() < helpers))
+                trial_pool.reset(new TrialPool(helpers));
+            context.trial_pool = trial_pool.get();
+
+            reply.status = sfsReconstruct(image, job.params, height, &context);
+            reply.seconds = context.seconds;
+        }
+
+        if (reply.status == SFS_OK || reply.status == SFS_INCOMPLETE)
+        {
+            reply.rows = height.rows;
+            reply.cols = height.cols;
+
+            if (job.output == DAEMON_MESH)
+            {
+                std::ostringstream text;
+                if (job.mesh_tolerance < 0.0)
+                    writeMesh(text, height);
+                else
+                    writeAdaptiveMesh(text, height, job.mesh_tolerance);
+                mesh = text.str();
+                payload = mesh.data();
+                reply.payload_bytes = mesh.size();
+            }
+            else
+            {
+                payload = height.values[0];
+                reply.payload_bytes = uint64_t(height.rows) * height.cols * sizeof(double);
+            }
+        }
+    }
+    catch (const std::bad_alloc&)
+    {
+        reply.status = SFS_OUT_OF_MEMORY;
+        reply.rows = reply.cols = 0;
+        reply.payload_bytes = 0;
+        payload = nullptr;
+    }
+    catch (...)
+    {
+        reply.status = SFS_INTERNAL_ERROR;
+        reply.rows = reply.cols = 0;
+        reply.payload_bytes = 0;
+        payload = nullptr;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(job.connection->jobs_mutex);
+        job.connection->jobs.erase(job.id);
+    }
+
+    job.connection->reply(reply, payload);
+}
+
+// Worker thread: its workspace and line-search threads stay warm from one
+// job to the next
+static void workerLoop(JobQueue& queue)
+{
+    FrameArena workspace;
+    std::unique_ptr<TrialPool> trial_pool;
+    std::shared_ptr<Job> job;
+
+    while (queue.pop(job))
+    {
+        runJob(*job, workspace, trial_pool);
+        job.reset();
+    }
+}
+
+// Answer a request that cannot be queued
+static void refuse(Connection& connection, uint64_t job, int status)
+{
+    DaemonReply reply;
+    std::memset(&reply, 0, sizeof(reply));
+    reply.magic = daemon_reply_magic;
+    reply.job = job;
+    reply.status = status;
+    connection.reply(reply, nullptr);
+}
+
+// Reader thread of a connection: parse requests and queue the jobs
+static void serveConnection(const std::shared_ptr<Connection>& connection, JobQueue& queue)
+{
+    DaemonRequest request;
+
+    while (readAll(connection->fd, &request, sizeof(request)))
+    {
+        if (request.magic != daemon_request_magic)
+            break;
+
+        if (request.type == DAEMON_CANCEL)
+        {
+            std::lock_guard<std::mutex> lock(connection->jobs_mutex);
+            auto found = connection->jobs.find(request.job);
+            if (found != connection->jobs.end())
+                found->second->cancel = true;
+            continue;
+        }
+
+        std::shared_ptr<Job> job = std::make_shared<Job>();
+        job->id = request.job;
+        job->connection = connection;
+        job->params = request.params;
+        job->output = request.output;
+        job->mesh_tolerance = request.mesh_tolerance;
+
+        if (request.type == DAEMON_SOLVE_BUFFER)
+        {
+            if (request.rows < 2 || request.cols < 2 ||
+                request.rows > daemon_max_side || request.cols > daemon_max_side ||
+                long(request.rows) * request.cols > daemon_max_pixels)
+                break;
+
+            job->image = Matrix(request.rows, request.cols);
+            if (!readAll(connection->fd, job->image.values[0],
+                         size_t(request.rows) * request.cols * sizeof(double)))
+                break;
+        }
+        else if (request.type == DAEMON_SOLVE_PATH)
+        {
+            if (request.path_length == 0 || request.path_length > daemon_max_path)
+                break;
+
+            job->path.resize(request.path_length);
+            if (!readAll(connection->fd, &job->path[0], request.path_length))
+                break;
+        }
+        else
+        {
+            break;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(connection->jobs_mutex);
+            if (connection->jobs.count(job->id))
+            {
+                refuse(*connection, job->id, SFS_INVALID_ARGUMENT);   // id already in use
+                continue;
+            }
+            connection->jobs[job->id] = job;
+        }
+
+        if (!queue.push(job))
+        {
+            // Shutting down
+            job->cancel = true;
+            std::lock_guard<std::mutex> lock(connection->jobs_mutex);
+            connection->jobs.erase(job->id);
+            refuse(*connection, job->id, SFS_CANCELLED);
+            break;
+        }
+    }
+
+    // Client gone or protocol error: its remaining jobs are not wanted
+    connection->cancelAll();
+}
+
+int runDaemon(const std::string& socket_path, int workers, int queue_capacity)
+{
+    sockaddr_un address;
+    if (!unixAddress(socket_path, address))
+    {
+        std::cerr << "Error: socket path too long: " << socket_path << "\n";
+        return 1;
+    }
+
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(socket_path.c_str());
+
+    if (listen_fd < 0 ||
+        bind(listen_fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 ||
+        listen(listen_fd, 64) < 0)
+    {
+        std::cerr << "Error: unable to listen on " << socket_path << ": "
+                  << std::strerror(errno) << "\n";
+        return 1;
+    }
+
+    struct sigaction action;
+    std::memset(&action, 0, sizeof(action));
+    action.sa_handler = onSignal;
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+
+    if (workers < 1)
+        workers = 1;
+
+    JobQueue queue(queue_capacity);
+
+    std::vector<std::thread> pool;
+    for (int w = 0; w < workers; w++)
+        pool.emplace_back(workerLoop, std::ref(queue));
+
+    // Live connections, and the count of reader threads still running
+    std::mutex readers_mutex;
+    std::condition_variable readers_done;
+    std::vector<std::weak_ptr<Connection>> connections;
+    int readers = 0;
+
+    std::cout << "Serving on " << socket_path << " (" << workers << " workers, queue of "
+              << queue_capacity << ")" << std::endl;
+
+    while (!stop_requested)
+    {
+        pollfd listening = { listen_fd, POLLIN, 0 };
+        if (poll(&listening, 1, 250) <= 0)
+            continue;
+
+        int fd = accept(listen_fd, nullptr, nullptr);
+        if (fd < 0)
+            continue;
+
+        std::shared_ptr<Connection> connection = std::make_shared<Connection>(fd);
+
+        {
+            std::lock_guard<std::mutex> lock(readers_mutex);
+
+            // Forget closed connections
+            std::vector<std::weak_ptr<Connection>> live;
+            for (auto& known : connections)
+                if (!known.expired())
+                    live.push_back(known);
+            live.push_back(connection);
+            connections.swap(live);
+
+            readers++;
+        }
+
+        std::thread([connection, &queue, &readers_mutex, &readers_done, &readers]()
+        {
+            serveConnection(connection, queue);
+
+            std::lock_guard<std::mutex> lock(readers_mutex);
+            readers--;
+            readers_done.notify_all();
+        }).detach();
+    }
+
+    std::cout << "Shutting down" << std::endl;
+
+    close(listen_fd);
+    unlink(socket_path.c_str());
+
+    // Stop reading requests and cancel everything in flight
+    {
+        std::lock_guard<std::mutex> lock(readers_mutex);
+        for (auto& known : connections)
+        {
+            std::shared_ptr<Connection> connection = known.lock();
+            if (connection)
+            {
+                shutdown(connection->fd, SHUT_RD);
+                connection->cancelAll();
+            }
+        }
+    }
+
+    queue.close();
+    for (std::thread& worker : pool)
+        worker.join();
+
+    std::unique_lock<std::mutex> lock(readers_mutex);
+    readers_done.wait(lock, [&readers]() { return readers == 0; });
+
+    return 0;
+}
+
+int submitJob(const std::string& socket_path, const std::string& input,
+              const std::string& output, const sfs_params& params,
+              double mesh_tolerance)
+{
+    sockaddr_un address;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if (fd < 0 || !unixAddress(socket_path, address) ||
+        connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0)
+    {
+        std::cerr << "Error: unable to reach the daemon at " << socket_path << "\n";
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+
+    // The daemon resolves paths from its own working directory
+    char resolved[PATH_MAX];
+    std::string path = realpath(input.c_str(), resolved) ? resolved : input;
+
+    DaemonRequest request;
+    std::memset(&request, 0, sizeof(request));
+    request.magic = daemon_request_magic;
+    request.type = DAEMON_SOLVE_PATH;
+    request.job = 1;
+    request.output = DAEMON_MESH;
+    request.path_length = path.size();
+    request.mesh_tolerance = mesh_tolerance;
+    request.params = params;
+
+    DaemonReply reply;
+    std::string payload;
+
+    bool ok = writeAll(fd, &request, sizeof(request)) &&
+              writeAll(fd, path.data(), path.size()) &&
+              readAll(fd, &reply, sizeof(reply)) &&
+              reply.magic == daemon_reply_magic;
+
+    if (ok && reply.payload_bytes > 0)
+    {
+        payload.resize(reply.payload_bytes);
+        ok = readAll(fd, &payload[0], payload.size());
+    }
+
+    close(fd);
+
+    if (!ok)
+    {
+        std::cerr << "Error: connection to the daemon lost\n";
+        return -1;
+    }
+
+    if (!payload.empty())
+        std::ofstream(output, std::ios::binary).write(payload.data(), payload.size());
+
+    std::cout << "Job " << sfs_status_string(reply.status) << " in " << reply.seconds << " s\n";
+    return reply.status;
+}
@@ -0,0 +1,401 @@
+// Single-stage reconstruction: the shading energy written directly in the
+// height field. The slopes are forward differences of h,
+//     p(i, j) = (h(i + 1, j) - h(i, j)) / step_size
+//     q(i, j) = (h(i, j + 1) - h(i, j)) / step_size
+// on the (rows - 1) x (cols - 1) pixels where both are defined, so the
+// recovered surface is integrable by construction: there is no
+// integrability term and no second L-BFGS stage. The smoothness term is
+// the one of the two-stage energy applied to these slopes, i.e. squared
+// second differences of h.
+//
+// Smoothness on second differences makes the problem stiff (low
+// frequencies of h converge very slowly), so the solve runs coarse to
+// fine: the image is averaged down by 2x2 blocks until it is small, and
+// each level starts from the upsampled height of the level below.
+
+#include "../include/reflectance.hpp"
+#include "../include/matrix.hpp"
+#include "../include/vector.hpp"
+#include "../include/globals.hpp"
+#include "../include/perf_counters.hpp"
+
+#include <algorithm>
+#include <iostream>
+
+// Side below which the coarse-to-fine solve stops halving the image
+static const int direct_coarsest = 24;
+
+// Add (r + alpha e)² to the coefficients
+static inline void accumulate(LineModel& line, double r, double e)
+{
+    line.constant += r * r;
+    line.linear += 2.0 * r * e;
+    line.quadratic += e * e;
+}
+
+// Second differences of h at pixel k (0-based row i, column j):
+// p(i + 1, j) - p(i, j), q(i, j + 1) - q(i, j), and the mixed difference
+// p(i, j + 1) - p(i, j) = q(i + 1, j) - q(i, j), all times step_size
+static inline void secondDifferences(const double* h, int k, int cols,
+                                     double& hxx, double& hyy, double& hxy)
+{
+    hxx = h[k + 2 * cols] - 2.0 * h[k + cols] + h[k];
+    hyy = h[k + 2] - 2.0 * h[k + 1] + h[k];
+    hxy = h[k + cols + 1] - h[k + 1] - h[k + cols] + h[k];
+}
+
+template <typename Model>
+double directHeightObjective(const Vector<double>& h, const ShadingData<Model>& data)
+{
+    const Matrix& image = *data.image;
+    const EnergyWeights& weights = data.weights;
+    int cols = image.cols;
+    int slope_rows = image.rows - 1;
+    int slope_cols = image.cols - 1;
+    PerfScope perf("direct height objective", long(image.rows) * cols);
+
+    double data_term = 0.0;
+    double smoothness_term = 0.0;
+
+    for (int i = 0; i < slope_rows; i++)
+    {
+        for (int j = 0; j < slope_cols; j++)
+        {
+            int k = i * cols + j;
+
+            double p = (h.values[k + cols] - h.values[k]) / weights.step_size;
+            double q = (h.values[k + 1] - h.values[k]) / weights.step_size;
+
+            double r = image.values[i][j] - data.model.radiance(p, q);
+            data_term += r * r;
+
+            if (i < slope_rows - 1 && j < slope_cols - 1)
+            {
+                double hxx, hyy, hxy;
+                secondDifferences(h.values, k, cols, hxx, hyy, hxy);
+                smoothness_term += hxx * hxx + hyy * hyy + 2.0 * hxy * hxy;
+            }
+        }
+    }
+
+    data_term *= weights.step_size * weights.step_size;
+    smoothness_term *= weights.lambda_csmo / (weights.step_size * weights.step_size);
+
+    return data_term + smoothness_term;
+}
+
+template <typename Model>
+Vector<double> directHeightGradient(const Vector<double>& h, const ShadingData<Model>& data)
+{
+    const Matrix& image = *data.image;
+    const EnergyWeights& weights = data.weights;
+    int cols = image.cols;
+    int slope_rows = image.rows - 1;
+    int slope_cols = image.cols - 1;
+    PerfScope perf("direct height gradient", long(image.rows) * cols);
+
+    Vector<double> gradient(h.dimension, 0.0);
+    double* g = gradient.values;
+
+    double R, R_p, R_q;
+    double smoothness_weight = 2.0 * weights.lambda_csmo / (weights.step_size * weights.step_size);
+
+    for (int i = 0; i < slope_rows; i++)
+    {
+        for (int j = 0; j < slope_cols; j++)
+        {
+            int k = i * cols + j;
+
+            double p = (h.values[k + cols] - h.values[k]) / weights.step_size;
+            double q = (h.values[k + 1] - h.values[k]) / weights.step_size;
+
+            // Data term, through p and q to the three heights they use
+            data.model.shade(p, q, R, R_p, R_q);
+
+            double w = 2.0 * weights.step_size * (R - image.values[i][j]);
+            double g_p = w * R_p;
+            double g_q = w * R_q;
+
+            g[k + cols] += g_p;
+            g[k + 1] += g_q;
+            g[k] -= g_p + g_q;
+
+            // Smoothness term
+            if (i < slope_rows - 1 && j < slope_cols - 1)
+            {
+                double hxx, hyy, hxy;
+                secondDifferences(h.values, k, cols, hxx, hyy, hxy);
+
+                double c = smoothness_weight * hxx;
+                g[k + 2 * cols] += c;
+                g[k + cols] -= 2.0 * c;
+                g[k] += c;
+
+                c = smoothness_weight * hyy;
+                g[k + 2] += c;
+                g[k + 1] -= 2.0 * c;
+                g[k] += c;
+
+                c = 2.0 * smoothness_weight * hxy;
+                g[k + cols + 1] += c;
+                g[k + 1] -= c;
+                g[k + cols] -= c;
+                g[k] += c;
+            }
+        }
+    }
+
+    return gradient;
+}
+
+// Smoothness term: quadratic in h
+template <typename Model>
+LineModel directHeightLinePrepare(
+    const Vector<double>& h,
+    const Vector<double>& d,
+    const ShadingData<Model>& data
+)
+{
+    const EnergyWeights& weights = data.weights;
+    int cols = data.image->cols;
+    int slope_rows = data.image->rows - 1;
+    int slope_cols = data.image->cols - 1;
+    PerfScope perf("direct height line prepare", long(data.image->rows) * cols);
+
+    LineModel smoothness = { 0.0, 0.0, 0.0 };
+
+    for (int i = 0; i < slope_rows - 1; i++)
+    {
+        for (int j = 0; j < slope_cols - 1; j++)
+        {
+            int k = i * cols + j;
+
+            double hxx, hyy, hxy;
+            double dxx, dyy, dxy;
+            secondDifferences(h.values, k, cols, hxx, hyy, hxy);
+            secondDifferences(d.values, k, cols, dxx, dyy, dxy);
+
+            accumulate(smoothness, hxx, dxx);
+            accumulate(smoothness, hyy, dyy);
+            accumulate(smoothness, hxy, dxy);
+            accumulate(smoothness, hxy, dxy);
+        }
+    }
+
+    double weight = weights.lambda_csmo / (weights.step_size * weights.step_size);
+
+    LineModel line;
+    line.constant = weight * smoothness.constant;
+    line.linear = weight * smoothness.linear;
+    line.quadratic = weight * smoothness.quadratic;
+
+    return line;
+}
+
+// Data term at h + alpha d and its derivative in alpha, in one pass
+template <typename Model>
+double directHeightLineRemainder(
+    const Vector<double>& h,
+    const Vector<double>& d,
+    double alpha,
+    const ShadingData<Model>& data,
+    double& slope
+)
+{
+    const Matrix& image = *data.image;
+    const EnergyWeights& weights = data.weights;
+    int cols = image.cols;
+    PerfScope perf("direct height line remainder", long(image.rows) * cols);
+
+    double value = 0.0;
+    double R, R_p, R_q;
+    slope = 0.0;
+
+    for (int i = 0; i < image.rows - 1; i++)
+    {
+        for (int j = 0; j < image.cols - 1; j++)
+        {
+            int k = i * cols + j;
+
+            double dp = (d.values[k + cols] - d.values[k]) / weights.step_size;
+            double dq = (d.values[k + 1] - d.values[k]) / weights.step_size;
+            double p = (h.values[k + cols] - h.values[k]) / weights.step_size + alpha * dp;
+            double q = (h.values[k + 1] - h.values[k]) / weights.step_size + alpha * dq;
+
+            data.model.shade(p, q, R, R_p, R_q);
+
+            double r = image.values[i][j] - R;
+            value += r * r;
+            slope -= 2.0 * r * (R_p * dp + R_q * dq);
+        }
+    }
+
+    value *= weights.step_size * weights.step_size;
+    slope *= weights.step_size * weights.step_size;
+
+    return value;
+}
+
+// Image averaged over 2x2 blocks (a last odd row / column is averaged alone)
+static Matrix halveImage(const Matrix& image)
+{
+    Matrix coarse((image.rows + 1) / 2, (image.cols + 1) / 2);
+
+    for (int i = 0; i < coarse.rows; i++)
+    {
+        for (int j = 0; j < coarse.cols; j++)
+        {
+            double sum = 0.0;
+            int count = 0;
+
+            for (int a = 2 * i; a < std::min(2 * i + 2, image.rows); a++)
+            {
+                for (int b = 2 * j; b < std::min(2 * j + 2, image.cols); b++)
+                {
+                    sum += image.values[a][b];
+                    count++;
+                }
+            }
+
+            coarse.values[i][j] = sum / count;
+        }
+    }
+
+    return coarse;
+}
+
+// Bilinear upsampling of a coarse height to rows x cols; heights double
+// with the pixel spacing so that the slopes are kept
+static Vector<double> doubleHeight(const Vector<double>& h, int coarse_rows, int coarse_cols,
+                                   int rows, int cols)
+{
+    Vector<double> fine(rows * cols);
+
+    for (int i = 0; i < rows; i++)
+    {
+        double y = std::min(0.5 * i, coarse_rows - 1.0);
+        int i0 = std::min(int(y), coarse_rows - 2);
+        double ty = y - i0;
+
+        for (int j = 0; j < cols; j++)
+        {
+            double x = std::min(0.5 * j, coarse_cols - 1.0);
+            int j0 = std::min(int(x), coarse_cols - 2);
+            double tx = x - j0;
+
+            const double* top = h.values + i0 * coarse_cols + j0;
+            const double* bottom = top + coarse_cols;
+
+            fine.values[i * cols + j] = 2.0 * (
+                (1.0 - ty) * ((1.0 - tx) * top[0] + tx * top[1]) +
+                ty * ((1.0 - tx) * bottom[0] + tx * bottom[1])
+            );
+        }
+    }
+
+    return fine;
+}
+
+// Pixels of image and of all its coarser levels
+static double pyramidPixels(int rows, int cols)
+{
+    double pixels = double(rows) * cols;
+    if (rows >= 2 * direct_coarsest && cols >= 2 * direct_coarsest)
+        pixels += pyramidPixels((rows + 1) / 2, (cols + 1) / 2);
+    return pixels;
+}
+
+template <typename Model>
+Vector<double> directHeightReconstruct(
+    const Matrix& image,
+    const Model& model,
+    const EnergyWeights& weights,
+    double grad_tol,
+    LBFGSControl* control
+)
+{
+    Vector<double> h0(image.rows * image.cols);
+
+    int iterations = 0;
+    double seconds = 0.0;
+
+    if (image.rows >= 2 * direct_coarsest && image.cols >= 2 * direct_coarsest)
+    {
+        Matrix coarse = halveImage(image);
+
+        // The coarser levels get their share of the time left, by pixel count
+        LBFGSControl coarse_control;
+        if (control)
+        {
+            coarse_control = *control;
+            if (control->has_deadline)
+            {
+                double share = pyramidPixels(coarse.rows, coarse.cols) /
+                               pyramidPixels(image.rows, image.cols);
+                LBFGSControl::Clock::time_point now = LBFGSControl::Clock::now();
+                coarse_control.deadline = now + std::chrono::duration_cast<LBFGSControl::Clock::duration>(
+                    (control->deadline - now) * share);
+            }
+        }
+
+        Vector<double> h = directHeightReconstruct(coarse, model, weights, grad_tol,
+                                                   control ? &coarse_control : nullptr);
+        h0 = doubleHeight(h, coarse.rows, coarse.cols, image.rows, image.cols);
+
+        iterations = coarse_control.iterations;
+        seconds = coarse_control.seconds;
+    }
+    else
+    {
+        // Coarsest level: the plane of slopes p = q = 0.5 (the two-stage initial guess)
+        for (int i = 0; i < image.rows; i++)
+            for (int j = 0; j < image.cols; j++)
+                h0.values[i * image.cols + j] = 0.5 * weights.step_size * (i + j);
+    }
+
+    if (!control || control->verbose)
+        std::cout << "Direct height level " << image.rows << " x " << image.cols << "\n";
+
+    ShadingData<Model> data = { &image, model, weights };
+    LineSearch<ShadingData<Model>> line = {
+        directHeightLinePrepare<Model>,
+        directHeightLineRemainder<Model>
+    };
+
+    Vector<double> h = LBFGS(h0, directHeightObjective<Model>, directHeightGradient<Model>,
+                             data, grad_tol, &line, control);
+
+    // Report the finest level, with the work of all levels
+    if (control)
+    {
+        control->iterations += iterations;
+        control->seconds += seconds;
+    }
+
+    return h;
+}
+
+template double directHeightObjective(const Vector<double>&, const ShadingData<FrontalLambertian>&);
+template double directHeightObjective(const Vector<double>&, const ShadingData<Lambertian>&);
+template double directHeightObjective(const Vector<double>&, const ShadingData<LommelSeeliger>&);
+template double directHeightObjective(const Vector<double>&, const ShadingData<HapkeLite>&);
+
+template Vector<double> directHeightGradient(const Vector<double>&, const ShadingData<FrontalLambertian>&);
+template Vector<double> directHeightGradient(const Vector<double>&, const ShadingData<Lambertian>&);
+template Vector<double> directHeightGradient(const Vector<double>&, const ShadingData<LommelSeeliger>&);
+template Vector<double> directHeightGradient(const Vector<double>&, const ShadingData<HapkeLite>&);
+
+template LineModel directHeightLinePrepare(const Vector<double>&, const Vector<double>&, const ShadingData<FrontalLambertian>&);
+template LineModel directHeightLinePrepare(const Vector<double>&, const Vector<double>&, const ShadingData<Lambertian>&);
+template LineModel directHeightLinePrepare(const Vector<double>&, const Vector<double>&, const ShadingData<LommelSeeliger>&);
+template LineModel directHeightLinePrepare(const Vector<double>&, const Vector<double>&, const ShadingData<HapkeLite>&);
+
+template double directHeightLineRemainder(const Vector<double>&, const Vector<double>&, double, const ShadingData<FrontalLambertian>&, double&);
+template double directHeightLineRemainder(const Vector<double>&, const Vector<double>&, double, const ShadingData<Lambertian>&, double&);
+template double directHeightLineRemainder(const Vector<double>&, const Vector<double>&, double, const ShadingData<LommelSeeliger>&, double&);
+template double directHeightLineRemainder(const Vector<double>&, const Vector<double>&, double, const ShadingData<HapkeLite>&, double&);
+
+template Vector<double> directHeightReconstruct(const Matrix&, const FrontalLambertian&, const EnergyWeights&, double, LBFGSControl*);
+template Vector<double> directHeightReconstruct(const Matrix&, const Lambertian&, const EnergyWeights&, double, LBFGSControl*);
+template Vector<double> directHeightReconstruct(const Matrix&, const LommelSeeliger&, const EnergyWeights&, double, LBFGSControl*);
+template Vector<double> directHeightReconstruct(const Matrix&, const HapkeLite&, const EnergyWeights&, double, LBFGSControl*);
@@ -0,0 +1,729 @@
+// Shared-memory domain decomposition of the reconstruction across worker
+// processes (see distributed.hpp)
+
+#include "../include/distributed.hpp"
+#include "../include/matrix.hpp"
+#include "../include/vector.hpp"
+#include "../include/reflectance.hpp"
+#include "../include/globals.hpp"
+#include "../include/numa_topology.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cmath>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace
+{
+
+const int max_reduce = 4;       // values combined by one reduction
+const size_t page = 4096;
+
+// How a stage of worker 0 ended, for the parent's report
+struct StageReport
+{
+    int reason;                 // index in stop_reasons
+    int iterations;
+    double objective;
+    double gradient_norm;
+    double seconds;
+};
+
+const char* const stop_reasons[] = { "gradient", "iterations", "deadline", "stalled", "cancelled" };
+const int num_stop_reasons = 5;
+
+// First page of the shared segment
+struct SharedHeader
+{
+    pthread_barrier_t barrier;
+    std::atomic<bool> cancel;   // set by the parent, polled by the workers
+    StageReport reports[2];
+};
+
+// Layout of the shared segment (offsets in bytes, page aligned)
+struct SharedLayout
+{
+    size_t header;              // SharedHeader
+    size_t slots;               // num_workers * max_reduce doubles
+    size_t image;               // N doubles
+    size_t point;               // 2N doubles: point being evaluated
+    size_t direction;           // 2N doubles: search direction of a line model
+    size_t pq;                  // 2N doubles: first-stage result
+    size_t height;              // N doubles: second-stage result
+    size_t total;
+};
+
+size_t pageAlign(size_t bytes)
+{
+    return (bytes + page - 1) / page * page;
+}
+
+SharedLayout makeLayout(int num_workers, int n)
+{
+    SharedLayout layout;
+    layout.header = 0;
+    layout.slots = pageAlign(sizeof(SharedHeader));
+    layout.image = layout.slots + pageAlign(num_workers * max_reduce * sizeof(double));
+    layout.point = layout.image + pageAlign(n * sizeof(double));
+    layout.direction = layout.point + pageAlign(2 * size_t(n) * sizeof(double));
+    layout.pq = layout.direction + pageAlign(2 * size_t(n) * sizeof(double));
+    layout.height = layout.pq + pageAlign(2 * size_t(n) * sizeof(double));
+    layout.total = layout.height + pageAlign(n * sizeof(double));
+    return layout;
+}
+
+StageReport toReport(const LBFGSControl& control)
+{
+    StageReport report;
+    report.reason = 0;
+    for (int r = 0; r < num_stop_reasons; r++)
+        if (!std::strcmp(control.stop_reason, stop_reasons[r]))
+            report.reason = r;
+
+    report.iterations = control.iterations;
+    report.objective = control.objective;
+    report.gradient_norm = control.gradient_norm;
+    report.seconds = control.seconds;
+    return report;
+}
+
+void fromReport(const StageReport& report, LBFGSControl& control)
+{
+    control.stop_reason = stop_reasons[report.reason];
+    control.iterations = report.iterations;
+    control.objective = report.objective;
+    control.gradient_norm = report.gradient_norm;
+    control.seconds = report.seconds;
+}
+
+} // namespace
+
+struct BandWorker
+{
+    int id;
+    int num_workers;
+    int rows, cols;
+    int row_begin, row_end;     // owned band [row_begin, row_end)
+
+    pthread_barrier_t* barrier;
+    double* slots;
+    double* image;
+    double* point;
+    double* direction;
+    double* pq;
+    double* height;
+
+    int bandSize() const
+    {
+        return (row_end - row_begin) * cols;
+    }
+
+    void wait()
+    {
+        pthread_barrier_wait(barrier);
+    }
+
+    // Global sums of k local values, identical on every worker
+    void sum(double* values, int k)
+    {
+        for (int i = 0; i < k; i++)
+            slots[id * max_reduce + i] = values[i];
+
+        wait();
+
+        for (int i = 0; i < k; i++)
+        {
+            values[i] = 0.0;
+            for (int w = 0; w < num_workers; w++)
+                values[i] += slots[w * max_reduce + i];
+        }
+
+        wait();
+    }
+
+    double sum(double value)
+    {
+        sum(&value, 1);
+        return value;
+    }
+
+    // Copy a local vector of planes planes (p then q, or h) into the owned
+    // rows of a shared array
+    void publish(const Vector<double>& local, double* shared, int planes) const
+    {
+        int n = rows * cols;
+        int band = bandSize();
+
+        for (int plane = 0; plane < planes; plane++)
+            std::memcpy(shared + plane * n + row_begin * cols, local.values + plane * band,
+                        band * sizeof(double));
+    }
+};
+
+namespace
+{
+
+// Add (r + alpha e)² to the coefficients
+inline void accumulate(LineModel& line, double r, double e)
+{
+    line.constant += r * r;
+    line.linear += 2.0 * r * e;
+    line.quadratic += e * e;
+}
+
+// First stage on a band: local unknowns are the owned rows of p then q.
+// Terms are anchored on the owned pixels (reading one halo row below);
+// the reduction's barriers also keep the point unchanged until every
+// worker is done reading its halos.
+double shadingBandObjective(const Vector<double>& x, const BandData& data)
+{
+    BandWorker& worker = *data.worker;
+    const EnergyWeights& w = data.weights;
+    int rows = worker.rows, cols = worker.cols;
+
+    worker.publish(x, worker.point, 2);
+    worker.wait();
+
+    const double* p = worker.point;
+    const double* q = worker.point + rows * cols;
+    const double* image = worker.image;
+    FrontalLambertian model;
+
+    double data_term = 0.0, integrability_term = 0.0, smoothness_term = 0.0;
+
+    for (int i = worker.row_begin; i < worker.row_end; i++)
+    {
+        for (int j = 0; j < cols; j++)
+        {
+            int k = i * cols + j;
+            double r = image[k] - model.radiance(p[k], q[k]);
+            data_term += r * r;
+
+            if (i != rows - 1 && j != cols - 1)
+            {
+                double c = p[k + 1] - p[k] - q[k + cols] + q[k];
+                integrability_term += c * c;
+
+                double a = p[k + cols] - p[k], b = p[k + 1] - p[k];
+                double e = q[k + 1] - q[k], f = q[k + cols] - q[k];
+                smoothness_term += a * a + b * b + e * e + f * f;
+            }
+        }
+    }
+
+    return worker.sum(w.step_size * w.step_size * data_term
+                      + w.lambda_internal * integrability_term
+                      + w.lambda_csmo * smoothness_term);
+}
+
+// Gradient entries of the owned unknowns, as in computeGradient
+Vector<double> shadingBandGradient(const Vector<double>& x, const BandData& data)
+{
+    BandWorker& worker = *data.worker;
+    const EnergyWeights& w = data.weights;
+    int rows = worker.rows, cols = worker.cols;
+    int band = worker.bandSize();
+
+    worker.publish(x, worker.point, 2);
+    worker.wait();
+
+    const double* p = worker.point;
+    const double* q = worker.point + rows * cols;
+    const double* image = worker.image;
+    FrontalLambertian model;
+    double R, R_p, R_q;
+
+    Vector<double> g(x.dimension);
+
+    for (int i = worker.row_begin; i < worker.row_end; i++)
+    {
+        for (int j = 0; j < cols; j++)
+        {
+            int k = i * cols + j;
+            int local = (i - worker.row_begin) * cols + j;
+
+            model.shade(p[k], q[k], R, R_p, R_q);
+
+            double gp = w.step_size * w.step_size * (R - image[k]) * R_p;
+            double gq = w.step_size * w.step_size * (R - image[k]) * R_q;
+
+            if (i != 0 && j != 0 && i != rows - 1 && j != cols - 1)
+            {
+                gp += w.lambda_internal * (
+                    2 * p[k] - p[k - 1] - p[k + 1]
+                    - q[k] + q[k + cols] - q[k + cols - 1] + q[k - 1]);
+                gp += w.lambda_csmo * (
+                    4 * p[k] - p[k - cols] - p[k + cols] - p[k - 1] - p[k + 1]);
+
+                gq += w.lambda_internal * (
+                    2 * q[k] - q[k - cols] - q[k + cols]
+                    - p[k] + p[k + 1] - p[k - cols + 1] + p[k - cols]);
+                gq += w.lambda_csmo * (
+                    4 * q[k] - q[k - cols] - q[k + cols] - q[k - 1] - q[k + 1]);
+            }
+
+            g.values[local] = 2 * gp;
+            g.values[band + local] = 2 * gq;
+        }
+    }
+
+    worker.wait();  // halos read
+    return g;
+}
+
+// Integrability and smoothness along x + alpha d, as in shadingLinePrepare
+LineModel shadingBandLinePrepare(const Vector<double>& x, const Vector<double>& d, const BandData& data)
+{
+    BandWorker& worker = *data.worker;
+    const EnergyWeights& w = data.weights;
+    int rows = worker.rows, cols = worker.cols, n = rows * cols;
+
+    worker.publish(x, worker.point, 2);
+    worker.publish(d, worker.direction, 2);
+    worker.wait();
+
+    const double* p = worker.point;
+    const double* q = worker.point + n;
+    const double* dp = worker.direction;
+    const double* dq = worker.direction + n;
+
+    LineModel integrability = { 0.0, 0.0, 0.0 };
+    LineModel smoothness = { 0.0, 0.0, 0.0 };
+
+    for (int i = worker.row_begin; i < std::min(worker.row_end, rows - 1); i++)
+    {
+        for (int j = 0; j < cols - 1; j++)
+        {
+            int k = i * cols + j;
+            int down = k + cols;
+            int right = k + 1;
+
+            accumulate(integrability,
+                       p[right] - p[k] - q[down] + q[k],
+                       dp[right] - dp[k] - dq[down] + dq[k]);
+
+            accumulate(smoothness, p[down] - p[k], dp[down] - dp[k]);
+            accumulate(smoothness, p[right] - p[k], dp[right] - dp[k]);
+            accumulate(smoothness, q[right] - q[k], dq[right] - dq[k]);
+            accumulate(smoothness, q[down] - q[k], dq[down] - dq[k]);
+        }
+    }
+
+    double sums[3] = {
+        w.lambda_internal * integrability.constant + w.lambda_csmo * smoothness.constant,
+        w.lambda_internal * integrability.linear + w.lambda_csmo * smoothness.linear,
+        w.lambda_internal * integrability.quadratic + w.lambda_csmo * smoothness.quadratic
+    };
+    worker.sum(sums, 3);
+
+    LineModel line = { sums[0], sums[1], sums[2] };
+    return line;
+}
+
+// Data term at x + alpha d and its slope: owned pixels only, no halo
+double shadingBandLineRemainder(const Vector<double>& x, const Vector<double>& d, double alpha,
+                                const BandData& data, double& slope)
+{
+    BandWorker& worker = *data.worker;
+    const EnergyWeights& w = data.weights;
+    int band = worker.bandSize();
+    const double* image = worker.image + worker.row_begin * worker.cols;
+    FrontalLambertian model;
+    double R, R_p, R_q;
+
+    double sums[2] = { 0.0, 0.0 };
+
+    for (int k = 0; k < band; k++)
+    {
+        double dp = d.values[k], dq = d.values[band + k];
+        model.shade(x.values[k] + alpha * dp, x.values[band + k] + alpha * dq, R, R_p, R_q);
+
+        double r = image[k] - R;
+        sums[0] += r * r;
+        sums[1] -= 2.0 * r * (R_p * dp + R_q * dq);
+    }
+
+    sums[0] *= w.step_size * w.step_size;
+    sums[1] *= w.step_size * w.step_size;
+    worker.sum(sums, 2);
+
+    slope = sums[1];
+    return sums[0];
+}
+
+// Second stage on a band: local unknowns are the owned rows of h, and the
+// slopes are the first stage's result in the shared pq
+double heightBandObjective(const Vector<double>& h_local, const BandData& data)
+{
+    BandWorker& worker = *data.worker;
+    const EnergyWeights& w = data.weights;
+    int rows = worker.rows, cols = worker.cols;
+
+    worker.publish(h_local, worker.point, 1);
+    worker.wait();
+
+    const double* h = worker.point;
+    const double* p = worker.pq;
+    const double* q = worker.pq + rows * cols;
+
+    double value = 0.0;
+
+    for (int i = worker.row_begin; i < std::min(worker.row_end, rows - 1); i++)
+    {
+        for (int j = 0; j < cols - 1; j++)
+        {
+            int k = i * cols + j;
+            double a = h[k + cols] - h[k] - w.step_size * p[k];
+            double b = h[k + 1] - h[k] - w.step_size * q[k];
+            value += a * a + b * b;
+        }
+    }
+
+    return worker.sum(value);
+}
+
+// As in heightGradient: the outer ring of the frame stays fixed
+Vector<double> heightBandGradient(const Vector<double>& h_local, const BandData& data)
+{
+    BandWorker& worker = *data.worker;
+    const EnergyWeights& w = data.weights;
+    int rows = worker.rows, cols = worker.cols;
+
+    worker.publish(h_local, worker.point, 1);
+    worker.wait();
+
+    const double* h = worker.point;
+    const double* p = worker.pq;
+    const double* q = worker.pq + rows * cols;
+
+    Vector<double> g(h_local.dimension);
+
+    for (int i = worker.row_begin; i < worker.row_end; i++)
+    {
+        for (int j = 0; j < cols; j++)
+        {
+            int k = i * cols + j;
+            int local = (i - worker.row_begin) * cols + j;
+
+            if (i != 0 && j != 0 && i != rows - 1 && j != cols - 1)
+                g.values[local] = 2 * (
+                    4 * h[k]
+                    - h[k - cols] - w.step_size * p[k - cols]
+                    - h[k + cols] + w.step_size * p[k]
+                    - h[k - 1] - w.step_size * q[k - 1]
+                    - h[k + 1] + w.step_size * q[k]);
+            else
+                g.values[local] = 0.0;
+        }
+    }
+
+    worker.wait();  // halos read
+    return g;
+}
+
+// The height objective along h + alpha d, as in heightLinePrepare
+LineModel heightBandLinePrepare(const Vector<double>& h_local, const Vector<double>& d_local,
+                                const BandData& data)
+{
+    BandWorker& worker = *data.worker;
+    const EnergyWeights& w = data.weights;
+    int rows = worker.rows, cols = worker.cols;
+
+    worker.publish(h_local, worker.point, 1);
+    worker.publish(d_local, worker.direction, 1);
+    worker.wait();
+
+    const double* h = worker.point;
+    const double* d = worker.direction;
+    const double* p = worker.pq;
+    const double* q = worker.pq + rows * cols;
+
+    LineModel line = { 0.0, 0.0, 0.0 };
+
+    for (int i = worker.row_begin; i < std::min(worker.row_end, rows - 1); i++)
+    {
+        for (int j = 0; j < cols - 1; j++)
+        {
+            int k = i * cols + j;
+            int down = k + cols;
+            int right = k + 1;
+
+            accumulate(line, h[down] - h[k] - w.step_size * p[k], d[down] - d[k]);
+            accumulate(line, h[right] - h[k] - w.step_size * q[k], d[right] - d[k]);
+        }
+    }
+
+    double sums[3] = { line.constant, line.linear, line.quadratic };
+    worker.sum(sums, 3);
+
+    line = { sums[0], sums[1], sums[2] };
+    return line;
+}
+
+// Body of a worker process: the shared solver on the band, with the
+// reduction through the worker's slots. Trial steps are evaluated one at
+// a time and the kernels run on this worker's core only.
+void runWorker(
+    BandWorker& worker,
+    const Matrix& image,
+    const EnergyWeights& weights,
+    double grad_tol_1,
+    double grad_tol_2,
+    LBFGSControl first,
+    LBFGSControl second,
+    const ContinuationSchedule& schedule,
+    SharedHeader* header
+)
+{
+    // First touch of the band's image rows (the other shared arrays are
+    // first written by publish, each worker on its own rows)
+    for (int i = worker.row_begin; i < worker.row_end; i++)
+        std::memcpy(worker.image + i * worker.cols, image.values[i], worker.cols * sizeof(double));
+
+    for (LBFGSControl* control : { &first, &second })
+    {
+        control->verbose = control->verbose && worker.id == 0;
+        control->kernel_threads = 1;
+        control->workspace = nullptr;
+        if (control->cancel)
+            control->cancel = &header->cancel;
+        control->reduce = [&worker](double* values, int count) { worker.sum(values, count); };
+    }
+
+    BandData band = { &worker, weights };
+
+    // First stage: p and q
+    LineSearch<BandData> shading_line = { shadingBandLinePrepare, shadingBandLineRemainder };
+
+    if (first.verbose)
+        std::cout << "L-BFGS on objective function (" << worker.num_workers << " workers)\n";
+
+    Vector<double> x0(2 * worker.bandSize(), 0.5);
+    Vector<double> x = continuationLBFGS(x0, shadingBandObjective, shadingBandGradient, band,
+                                         grad_tol_1, &shading_line, &first, schedule);
+
+    worker.publish(x, worker.pq, 2);
+
+    // Second stage: height, with exact steps
+    LineSearch<BandData> height_line = { heightBandLinePrepare, nullptr };
+
+    if (second.verbose)
+        std::cout << "L-BFGS on height\n";
+
+    Vector<double> h0(worker.bandSize(), 0.0);
+    worker.wait();  // pq complete
+
+    Vector<double> h = LBFGS(h0, heightBandObjective, heightBandGradient, band,
+                             grad_tol_2, &height_line, &second);
+    worker.publish(h, worker.height, 1);
+
+    if (worker.id == 0)
+    {
+        header->reports[0] = toReport(first);
+        header->reports[1] = toReport(second);
+    }
+}
+
+} // namespace
+
+Matrix distributedReconstruct(
+    const Matrix& image,
+    const EnergyWeights& weights,
+    int num_workers,
+    double grad_tol_1,
+    double grad_tol_2,
+    LBFGSControl* first,
+    LBFGSControl* second,
+    const ContinuationSchedule& schedule,
+    long memory_limit_mb,
+    bool pin_workers
+)
+{
+    int rows = image.rows;
+    int cols = image.cols;
+    int n = rows * cols;
+
+    if (num_workers < 1 || rows < 2 * num_workers)
+    {
+        std::cerr << "Error: need at least two image rows per worker.\n";
+        std::exit(1);
+    }
+
+    // Shared segment, unlinked right away: it lives as long as the mappings
+    SharedLayout layout = makeLayout(num_workers, n);
+    std::string name = "/sfs-" + std::to_string(getpid());
+
+    int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0)
+    {
+        std::cerr << "Error: unable to create shared memory segment.\n";
+        std::exit(1);
+    }
+    shm_unlink(name.c_str());
+
+    if (ftruncate(fd, layout.total) != 0)
+    {
+        std::cerr << "Error: unable to size shared memory segment.\n";
+        std::exit(1);
+    }
+
+    char* base = static_cast<char*>(
+        mmap(nullptr, layout.total, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0));
+    close(fd);
+
+    if (base == MAP_FAILED)
+    {
+        std::cerr << "Error: unable to map shared memory segment.\n";
+        std::exit(1);
+    }
+
+    SharedHeader* header = reinterpret_cast<SharedHeader*>(base + layout.header);
+    pthread_barrier_t* barrier = &header->barrier;
+    new (&header->cancel) std::atomic<bool>(false);
+
+    pthread_barrierattr_t attributes;
+    pthread_barrierattr_init(&attributes);
+    pthread_barrierattr_setpshared(&attributes, PTHREAD_PROCESS_SHARED);
+    pthread_barrier_init(barrier, &attributes, num_workers);
+    pthread_barrierattr_destroy(&attributes);
+
+    // The segment's pages are left untouched here: each worker faults in
+    // its own band
+    double* shared_image = reinterpret_cast<double*>(base + layout.image);
+    NumaTopology topology = readNumaTopology();
+
+    std::cout.flush();
+
+    // Fork the workers, one band each
+    std::vector<pid_t> children;
+
+    for (int w = 0; w < num_workers; w++)
+    {
+        pid_t pid = fork();
+
+        if (pid < 0)
+        {
+            std::cerr << "Error: unable to start worker process.\n";
+            for (pid_t child : children)
+                kill(child, SIGKILL);
+            std::exit(1);
+        }
+
+        if (pid == 0)
+        {
+            // Pinned before any allocation, so private buffers are local too
+            if (pin_workers)
+                pinToCpu(workerCpu(topology, w, num_workers));
+
+            if (memory_limit_mb > 0)
+            {
+                struct rlimit limit;
+                limit.rlim_cur = limit.rlim_max = rlim_t(memory_limit_mb) << 20;
+                setrlimit(RLIMIT_AS, &limit);
+            }
+
+            BandWorker worker;
+            worker.id = w;
+            worker.num_workers = num_workers;
+            worker.rows = rows;
+            worker.cols = cols;
+            worker.row_begin = rows * w / num_workers;
+            worker.row_end = rows * (w + 1) / num_workers;
+            worker.barrier = barrier;
+            worker.slots = reinterpret_cast<double*>(base + layout.slots);
+            worker.image = shared_image;
+            worker.point = reinterpret_cast<double*>(base + layout.point);
+            worker.direction = reinterpret_cast<double*>(base + layout.direction);
+            worker.pq = reinterpret_cast<double*>(base + layout.pq);
+            worker.height = reinterpret_cast<double*>(base + layout.height);
+
+            runWorker(worker, image, weights, grad_tol_1, grad_tol_2, *first, *second,
+                      schedule, header);
+
+            std::cout.flush();
+            _exit(0);
+        }
+
+        children.push_back(pid);
+    }
+
+    // Wait on the workers only (the host may have children of its own),
+    // polling so that a worker that dies, which would leave the others
+    // waiting at a barrier, is noticed whichever it is, and a cancel flag
+    // can be passed on. A worker that cannot be waited for counts as
+    // failed: its band may still be written.
+    const std::atomic<bool>* cancel = first->cancel ? first->cancel : second->cancel;
+    std::vector<pid_t> running = children;
+    bool failed = false;
+
+    while (!running.empty())
+    {
+        bool reaped = false;
+
+        for (size_t k = 0; k < running.size(); )
+        {
+            int status = 0;
+            pid_t pid = waitpid(running[k], &status, WNOHANG);
+
+            if (pid == 0)
+            {
+                k++;
+                continue;
+            }
+
+            if (pid < 0 && errno == EINTR)
+                continue;
+
+            running.erase(running.begin() + k);
+            reaped = true;
+
+            if (!failed && !(pid > 0 && WIFEXITED(status) && WEXITSTATUS(status) == 0))
+            {
+                failed = true;
+                for (pid_t child : running)
+                    kill(child, SIGKILL);
+            }
+        }
+
+        if (!reaped)
+        {
+            if (cancel && cancel->load(std::memory_order_relaxed))
+                header->cancel.store(true, std::memory_order_relaxed);
+            usleep(1000);
+        }
+    }
+
+    if (failed)
+    {
+        std::cerr << "Error: a worker process failed.\n";
+        std::exit(1);
+    }
+
+    Matrix height(rows, cols);
+    const double* shared_height = reinterpret_cast<double*>(base + layout.height);
+    for (int i = 0; i < rows; i++)
+        for (int j = 0; j < cols; j++)
+            height.values[i][j] = shared_height[i * cols + j];
+
+    fromReport(header->reports[0], *first);
+    fromReport(header->reports[1], *second);
+
+    pthread_barrier_destroy(barrier);
+    munmap(base, layout.total);
+
+    return height;
+}
@@ -1,12 +1,16 @@
 #include "../include/matrix.hpp"
 #include "../include/vector.hpp"
-#include "../include/globals.hpp"
+#include "../include/lbfgs.hpp"
+#include "../include/perf_counters.hpp"
 
 // Definition of the height gradient
-Vector<double> heightGradient(const Vector<double>& h, const Matrix& x)
+Vector<double> heightGradient(const Vector<double>& h, const HeightData& data)
 {
+    const Matrix& x = *data.derivatives;
+    const EnergyWeights& weights = data.weights;
     int num_rows = x.rows / 2;
     int num_cols = x.cols;
+    PerfScope perf("height gradient", long(num_rows) * num_cols);
 
     Matrix height = h.toMatrix(num_rows, num_cols);
     Matrix gradient(num_rows, num_cols, 0.0);
@@ -19,10 +23,10 @@ Vector<double> heightGradient(const Vector<double>& h, const Matrix& x)
             {
                 gradient(i, j) =
                     4 * height(i, j)
-                    - height(i - 1, j) - step_size * x(i - 1, j)
-                    - height(i + 1, j) + step_size * x(i, j)
-                    - height(i, j - 1) - step_size * x(i + num_rows, j - 1)
-                    - height(i, j + 1) + step_size * x(i + num_rows, j);
+                    - height(i - 1, j) - weights.step_size * x(i - 1, j)
+                    - height(i + 1, j) + weights.step_size * x(i, j)
+                    - height(i, j - 1) - weights.step_size * x(i + num_rows, j - 1)
+                    - height(i, j + 1) + weights.step_size * x(i + num_rows, j);
             }
         }
     }
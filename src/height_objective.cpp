@@ -1,13 +1,17 @@
 #include "../include/vector.hpp"
 #include "../include/matrix.hpp"
-#include "../include/globals.hpp"
+#include "../include/lbfgs.hpp"
+#include "../include/perf_counters.hpp"
 #include <cmath>
 
 // Definition of the height objective function
-double heightObjective(const Vector<double>& h, const Matrix& x)
+double heightObjective(const Vector<double>& h, const HeightData& data)
 {
+    const Matrix& x = *data.derivatives;
+    const EnergyWeights& weights = data.weights;
     int num_rows = x.rows / 2;
     int num_cols = x.cols;
+    PerfScope perf("height objective", long(num_rows) * num_cols);
 
     Matrix height = h.toMatrix(num_rows, num_cols);
     double value = 0.0;
@@ -17,8 +21,8 @@ double heightObjective(const Vector<double>& h, const Matrix& x)
         for (int j = 1; j < num_cols; j++)
         {
             value +=
-                std::pow(height(i + 1, j) - height(i, j) - step_size * x(i, j), 2)
-              + std::pow(height(i, j + 1) - height(i, j) - step_size * x(i + num_rows, j), 2);
+                std::pow(height(i + 1, j) - height(i, j) - weights.step_size * x(i, j), 2)
+              + std::pow(height(i, j + 1) - height(i, j) - weights.step_size * x(i + num_rows, j), 2);
         }
     }
 
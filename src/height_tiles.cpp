@@ -0,0 +1,376 @@
+// Tiled binary height maps with overview levels
+
+#include "../include/height_tiles.hpp"
+#include "../include/matrix.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char tile_magic[8] = { 'S', 'F', 'S', 'T', 'I', 'L', 'E', '1' };
+
+static uint64_t alignTo8(uint64_t offset)
+{
+    return (offset + 7) & ~uint64_t(7);
+}
+
+// Next overview: mean of each 2 x 2 block (fewer on odd edges)
+static Matrix halveHeights(const Matrix& M)
+{
+    Matrix half((M.rows + 1) / 2, (M.cols + 1) / 2);
+
+    for (int i = 0; i < half.rows; i++)
+    {
+        for (int j = 0; j < half.cols; j++)
+        {
+            double sum = 0.0;
+            int count = 0;
+
+            for (int a = 2 * i; a < std::min(2 * i + 2, M.rows); a++)
+            {
+                for (int b = 2 * j; b < std::min(2 * j + 2, M.cols); b++)
+                {
+                    sum += M.values[a][b];
+                    count++;
+                }
+            }
+
+            half.values[i][j] = sum / count;
+        }
+    }
+
+    return half;
+}
+
+static uint64_t bitsOf(double value)
+{
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+static double valueOf(uint64_t bits)
+{
+    double value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+// Delta-encode the tile [row, row + rows) x [col, col + cols) of M
+static void encodeDelta(const Matrix& M, int row, int col, int rows, int cols,
+                        std::vector<unsigned char>& out)
+{
+    uint64_t above = 0;
+
+    for (int i = 0; i < rows; i++)
+    {
+        uint64_t previous = above;
+        above = bitsOf(M.values[row + i][col]);
+
+        for (int j = 0; j < cols; j++)
+        {
+            uint64_t bits = bitsOf(M.values[row + i][col + j]);
+            int64_t difference = int64_t(bits - previous);
+            uint64_t zigzag = (uint64_t(difference) << 1) ^ uint64_t(difference >> 63);
+            previous = bits;
+
+            while (zigzag >= 0x80)
+            {
+                out.push_back((unsigned char)(zigzag | 0x80));
+                zigzag >>= 7;
+            }
+            out.push_back((unsigned char)zigzag);
+        }
+    }
+}
+
+// Inverse of encodeDelta; false on truncated or overlong data
+static bool decodeDelta(const unsigned char* in, size_t bytes, Matrix& tile)
+{
+    const unsigned char* end = in + bytes;
+    uint64_t above = 0;
+
+    for (int i = 0; i < tile.rows; i++)
+    {
+        uint64_t previous = above;
+
+        for (int j = 0; j < tile.cols; j++)
+        {
+            uint64_t zigzag = 0;
+            int shift = 0;
+
+            while (true)
+            {
+                if (in == end || shift > 63)
+                    return false;
+
+                unsigned char byte = *in++;
+                zigzag |= uint64_t(byte & 0x7f) << shift;
+                shift += 7;
+
+                if (!(byte & 0x80))
+                    break;
+            }
+
+            uint64_t difference = (zigzag >> 1) ^ (~(zigzag & 1) + 1);
+            previous += difference;
+            tile.values[i][j] = valueOf(previous);
+
+            if (j == 0)
+                above = previous;
+        }
+    }
+
+    return in == end;
+}
+
+void writeHeightTiles(const std::string& filename, const Matrix& height, int tile_size, bool delta)
+{
+    if (tile_size < 1 || height.rows < 1 || height.cols < 1)
+    {
+        throw std::runtime_error("invalid tiled height map (" + std::to_string(height.rows) + "x" +
+                                 std::to_string(height.cols) + ", tiles of " +
+                                 std::to_string(tile_size) + ")");
+    }
+
+    std::vector<Matrix> overviews;
+    overviews.push_back(height);
+    while (overviews.back().rows > tile_size || overviews.back().cols > tile_size)
+        overviews.push_back(halveHeights(overviews.back()));
+
+    TileFileHeader header;
+    std::memcpy(header.magic, tile_magic, sizeof(tile_magic));
+    header.rows = height.rows;
+    header.cols = height.cols;
+    header.tile_size = tile_size;
+    header.levels = overviews.size();
+
+    std::vector<TileLevel> levels(overviews.size());
+    uint64_t offset = sizeof(header) + levels.size() * sizeof(TileLevel);
+
+    for (size_t l = 0; l < overviews.size(); l++)
+    {
+        levels[l].rows = overviews[l].rows;
+        levels[l].cols = overviews[l].cols;
+        levels[l].tiles_down = (overviews[l].rows + tile_size - 1) / tile_size;
+        levels[l].tiles_across = (overviews[l].cols + tile_size - 1) / tile_size;
+        levels[l].index_offset = offset;
+        offset += uint64_t(levels[l].tiles_down) * levels[l].tiles_across * sizeof(TileEntry);
+    }
+
+    // Encode every tile, then lay them out after the indexes
+    std::vector<TileEntry> entries;
+    std::vector<std::vector<unsigned char>> tiles;
+
+    for (size_t l = 0; l < overviews.size(); l++)
+    {
+        const Matrix& M = overviews[l];
+
+        for (int ti = 0; ti < levels[l].tiles_down; ti++)
+        {
+            for (int tj = 0; tj < levels[l].tiles_across; tj++)
+            {
+                int row = ti * tile_size;
+                int col = tj * tile_size;
+                int rows = std::min(tile_size, M.rows - row);
+                int cols = std::min(tile_size, M.cols - col);
+                size_t raw_bytes = size_t(rows) * cols * sizeof(double);
+
+                std::vector<unsigned char> bytes;
+                TileEntry entry;
+                entry.encoding = TILE_RAW;
+
+                if (delta)
+                {
+                    encodeDelta(M, row, col, rows, cols, bytes);
+                    entry.encoding = TILE_DELTA;
+                }
+
+                if (!delta || bytes.size() >= raw_bytes)
+                {
+                    bytes.resize(raw_bytes);
+                    for (int i = 0; i < rows; i++)
+                        std::memcpy(&bytes[size_t(i) * cols * sizeof(double)],
+                                    &M.values[row + i][col], cols * sizeof(double));
+                    entry.encoding = TILE_RAW;
+                }
+
+                offset = alignTo8(offset);
+                entry.offset = offset;
+                entry.bytes = bytes.size();
+                offset += bytes.size();
+
+                entries.push_back(entry);
+                tiles.push_back(std::move(bytes));
+            }
+        }
+    }
+
+    std::ofstream file(filename, std::ios::binary);
+    if (!file)
+    {
+        throw std::runtime_error("unable to write " + filename);
+    }
+
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(levels.data()), levels.size() * sizeof(TileLevel));
+    file.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(TileEntry));
+
+    uint64_t written = sizeof(header) + levels.size() * sizeof(TileLevel) + entries.size() * sizeof(TileEntry);
+    static const char padding[8] = { 0 };
+
+    for (size_t t = 0; t < tiles.size(); t++)
+    {
+        file.write(padding, entries[t].offset - written);
+        file.write(reinterpret_cast<const char*>(tiles[t].data()), tiles[t].size());
+        written = entries[t].offset + tiles[t].size();
+    }
+
+    if (!file)
+    {
+        throw std::runtime_error("unable to write " + filename);
+    }
+}
+
+// "(row, col) at level l", for error messages
+static std::string tileName(int l, int tile_row, int tile_col)
+{
+    return "(" + std::to_string(tile_row) + ", " + std::to_string(tile_col) + ") at level " +
+           std::to_string(l);
+}
+
+HeightTileReader::HeightTileReader(const std::string& filename)
+    : data(nullptr), size(0), header(nullptr), level_table(nullptr)
+{
+    int fd = open(filename.c_str(), O_RDONLY);
+    struct stat status;
+
+    if (fd < 0 || fstat(fd, &status) < 0 || size_t(status.st_size) < sizeof(TileFileHeader))
+    {
+        if (fd >= 0)
+            close(fd);
+        throw std::runtime_error("unable to open tiled height map " + filename);
+    }
+
+    size = status.st_size;
+    void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (mapping == MAP_FAILED)
+        throw std::runtime_error("unable to map " + filename);
+
+    data = static_cast<const unsigned char*>(mapping);
+    header = reinterpret_cast<const TileFileHeader*>(data);
+    level_table = reinterpret_cast<const TileLevel*>(data + sizeof(TileFileHeader));
+
+    bool valid = !std::memcmp(header->magic, tile_magic, sizeof(tile_magic)) &&
+                 header->tile_size > 0 && header->levels > 0 &&
+                 size_t(header->levels) <= (size - sizeof(TileFileHeader)) / sizeof(TileLevel);
+
+    for (int l = 0; valid && l < header->levels; l++)
+    {
+        const TileLevel& level = level_table[l];
+        uint64_t tiles = uint64_t(level.tiles_down) * level.tiles_across;
+
+        valid = level.rows > 0 && level.cols > 0 &&
+                level.tiles_down == (level.rows + header->tile_size - 1) / header->tile_size &&
+                level.tiles_across == (level.cols + header->tile_size - 1) / header->tile_size &&
+                level.index_offset % 8 == 0 && level.index_offset <= size &&
+                tiles <= (size - level.index_offset) / sizeof(TileEntry);
+    }
+
+    if (!valid)
+    {
+        munmap(mapping, size);
+        throw std::runtime_error(filename + " is not a tiled height map");
+    }
+}
+
+HeightTileReader::~HeightTileReader()
+{
+    munmap(const_cast<unsigned char*>(data), size);
+}
+
+const TileLevel& HeightTileReader::level(int l) const
+{
+    if (l < 0 || l >= header->levels)
+        throw std::out_of_range("no overview level " + std::to_string(l));
+
+    return level_table[l];
+}
+
+Matrix HeightTileReader::tile(int l, int tile_row, int tile_col) const
+{
+    const TileLevel& lv = level(l);
+
+    if (tile_row < 0 || tile_row >= lv.tiles_down || tile_col < 0 || tile_col >= lv.tiles_across)
+        throw std::out_of_range("no tile " + tileName(l, tile_row, tile_col));
+
+    const TileEntry& entry = reinterpret_cast<const TileEntry*>(data + lv.index_offset)
+                                 [size_t(tile_row) * lv.tiles_across + tile_col];
+
+    int tile_size = header->tile_size;
+    Matrix result(std::min(tile_size, lv.rows - tile_row * tile_size),
+                  std::min(tile_size, lv.cols - tile_col * tile_size));
+
+    bool valid = entry.offset <= size && entry.bytes <= size - entry.offset;
+
+    if (valid && entry.encoding == TILE_RAW)
+    {
+        valid = entry.bytes == size_t(result.rows) * result.cols * sizeof(double);
+        for (int i = 0; valid && i < result.rows; i++)
+            std::memcpy(result.values[i], data + entry.offset + size_t(i) * result.cols * sizeof(double),
+                        result.cols * sizeof(double));
+    }
+    else if (valid && entry.encoding == TILE_DELTA)
+    {
+        valid = decodeDelta(data + entry.offset, entry.bytes, result);
+    }
+    else
+    {
+        valid = false;
+    }
+
+    if (!valid)
+        throw std::runtime_error("corrupted tile " + tileName(l, tile_row, tile_col));
+
+    return result;
+}
+
+Matrix HeightTileReader::region(int l, int row, int col, int rows, int cols) const
+{
+    const TileLevel& lv = level(l);
+
+    if (row < 0 || col < 0 || rows < 1 || cols < 1 || rows > lv.rows - row || cols > lv.cols - col)
+        throw std::out_of_range("region outside overview level " + std::to_string(l));
+
+    int tile_size = header->tile_size;
+    Matrix result(rows, cols);
+
+    for (int ti = row / tile_size; ti <= (row + rows - 1) / tile_size; ti++)
+    {
+        for (int tj = col / tile_size; tj <= (col + cols - 1) / tile_size; tj++)
+        {
+            Matrix t = tile(l, ti, tj);
+
+            int i0 = std::max(row, ti * tile_size);
+            int i1 = std::min(row + rows, ti * tile_size + t.rows);
+            int j0 = std::max(col, tj * tile_size);
+            int j1 = std::min(col + cols, tj * tile_size + t.cols);
+
+            for (int i = i0; i < i1; i++)
+                for (int j = j0; j < j1; j++)
+                    result.values[i - row][j - col] = t.values[i - ti * tile_size][j - tj * tile_size];
+        }
+    }
+
+    return result;
+}
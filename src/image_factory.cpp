@@ -1,15 +1,28 @@
 #include "../include/image_factory.hpp"
 #include "../include/matrix.hpp"
 #include "../include/vector.hpp"
+#include "../include/perf_counters.hpp"
 
+#include <algorithm>
+#include <atomic>
 #include <string>
 #include <cmath>
+#include <cstdlib>
 #include <iostream>
 #include <fstream>
+#include <thread>
+#include <vector>
 
-// Constructor: reads a mesh file
+// Constructor: reads a mesh file (Vertices, Quadrilaterals and Triangles sections)
 ImageFactory::ImageFactory(const char* filename)
 {
+    num_vertices = 0;
+    num_quadrilaterals = 0;
+    num_triangles = 0;
+    image_width = 0;
+    image_height = 0;
+    tile_size = 32;
+
     std::ifstream file(filename, std::ios::in);
 
     if (!file)
@@ -18,87 +31,249 @@ ImageFactory::ImageFactory(const char* filename)
         return;
     }
 
-    // Skip header lines
-    for (int i = 0; i < 8; i++)
-        file.ignore(50, '\n');
-
-    file >> num_vertices;
-    Matrix V(num_vertices, 3);
+    std::string keyword;
+    int ref;
 
-    for (int i = 1; i <= num_vertices; i++)
+    while (file >> keyword && keyword != "End")
     {
-        file >> V(i, 1);
-        file >> V(i, 2);
-        file >> V(i, 3);
-        file.ignore(50, '\n');
+        if (keyword == "MeshVersionFormatted" || keyword == "Dimension")
+        {
+            file >> ref;
+        }
+        else if (keyword == "Vertices")
+        {
+            file >> num_vertices;
+            vertices.resize(num_vertices);
+
+            for (Vec3d& v : vertices)
+                file >> v(1) >> v(2) >> v(3) >> ref;
+        }
+        else if (keyword == "Quadrilaterals")
+        {
+            file >> num_quadrilaterals;
+            quadrilaterals.resize(num_quadrilaterals);
+
+            for (Vec<int, 4>& Q : quadrilaterals)
+                file >> Q(1) >> Q(2) >> Q(3) >> Q(4) >> ref;
+        }
+        else if (keyword == "Triangles")
+        {
+            file >> num_triangles;
+            triangles.resize(num_triangles);
+
+            for (Vec<int, 3>& T : triangles)
+                file >> T(1) >> T(2) >> T(3) >> ref;
+        }
+        else
+        {
+            std::cerr << "Unsupported mesh section: " << keyword << std::endl;
+            break;
+        }
     }
 
-    file.ignore(50, '\n');
-    file.ignore(50, '\n');
+    file.close();
+
+    if (num_vertices == 0)
+        return;
 
-    file >> num_quadrilaterals;
-    Matrix Q(num_quadrilaterals, 4);
+    // Screen covers the (x, y) bounding box of the mesh, one pixel per unit
+    double x_min = vertices[0](1), x_max = x_min;
+    double y_min = vertices[0](2), y_max = y_min;
 
-    for (int i = 1; i <= num_quadrilaterals; i++)
+    for (const Vec3d& v : vertices)
     {
-        file >> Q(i, 1);
-        file >> Q(i, 2);
-        file >> Q(i, 3);
-        file >> Q(i, 4);
-        file.ignore(50, '\n');
+        x_min = std::min(x_min, v(1));
+        x_max = std::max(x_max, v(1));
+        y_min = std::min(y_min, v(2));
+        y_max = std::max(y_max, v(2));
     }
 
-    file.close();
+    origin_x = x_min;
+    origin_y = y_min;
+    image_height = static_cast<int>(std::ceil(x_max - x_min));
+    image_width  = static_cast<int>(std::ceil(y_max - y_min));
+}
+
+namespace
+{
+
+// Triangle ready for rasterization, with its upward unit normal
+struct ScreenTriangle
+{
+    Vec3d v[3];
+    Vec3d n;
+};
+
+// Rasterize one screen tile: every pixel keeps the closest (highest z)
+// triangle covering its centre
+void rasterizeTile(
+    int tile,
+    const std::vector<ScreenTriangle>& primitives,
+    const std::vector<std::vector<int>>& bins,
+    int tiles_x, int tile_size,
+    double origin_x, double origin_y,
+    const Vec3d& light,
+    Matrix& depth, Matrix& img, Matrix& derivatives
+)
+{
+    int rows = img.rows;
+    int cols = img.cols;
+
+    int r_begin = (tile / tiles_x) * tile_size;
+    int c_begin = (tile % tiles_x) * tile_size;
+    int r_end = std::min(r_begin + tile_size, rows);
+    int c_end = std::min(c_begin + tile_size, cols);
+
+    for (int index : bins[tile])
+    {
+        const ScreenTriangle& t = primitives[index];
+
+        // Pixel range of the triangle, clipped to the tile
+        double x_lo = std::min(t.v[0](1), std::min(t.v[1](1), t.v[2](1))) - origin_x;
+        double x_hi = std::max(t.v[0](1), std::max(t.v[1](1), t.v[2](1))) - origin_x;
+        double y_lo = std::min(t.v[0](2), std::min(t.v[1](2), t.v[2](2))) - origin_y;
+        double y_hi = std::max(t.v[0](2), std::max(t.v[1](2), t.v[2](2))) - origin_y;
+
+        int r0 = std::max(r_begin, static_cast<int>(std::ceil(x_lo - 0.5)));
+        int r1 = std::min(r_end - 1, static_cast<int>(std::floor(x_hi - 0.5)));
+        int c0 = std::max(c_begin, static_cast<int>(std::ceil(y_lo - 0.5)));
+        int c1 = std::min(c_end - 1, static_cast<int>(std::floor(y_hi - 0.5)));
+
+        const Vec3d& a = t.v[0];
+        const Vec3d& b = t.v[1];
+        const Vec3d& c = t.v[2];
+
+        double area = (b(1) - a(1)) * (c(2) - a(2)) - (c(1) - a(1)) * (b(2) - a(2));
+
+        double intensity = 255.0 * std::max(0.0, dot(light, t.n));
+        double p = -t.n(1) / t.n(3);
+        double q = -t.n(2) / t.n(3);
+
+        for (int r = r0; r <= r1; r++)
+        {
+            double px = origin_x + r + 0.5;
+
+            for (int col = c0; col <= c1; col++)
+            {
+                double py = origin_y + col + 0.5;
+
+                // Barycentric coordinates from the edge functions
+                double w0 = ((b(1) - px) * (c(2) - py) - (c(1) - px) * (b(2) - py)) / area;
+                double w1 = ((c(1) - px) * (a(2) - py) - (a(1) - px) * (c(2) - py)) / area;
+                double w2 = 1.0 - w0 - w1;
+
+                if (w0 < 0.0 || w1 < 0.0 || w2 < 0.0)
+                    continue;
+
+                double z = w0 * a(3) + w1 * b(3) + w2 * c(3);
 
-    vertices = V;
-    quadrilaterals = Q;
+                if (z <= depth.values[r][col])
+                    continue;
 
-    image_width  = static_cast<int>(vertices(num_vertices, 1));
-    image_height = static_cast<int>(vertices(num_vertices, 2));
+                depth.values[r][col] = z;
+                img.values[r][col] = intensity;
+                derivatives.values[r][col] = p;
+                derivatives.values[r + rows][col] = q;
+            }
+        }
+    }
 }
 
-// Convert 3D mesh to 2D image
-void ImageFactory::flatten(Vector<double>& source)
+} // namespace
+
+// Convert 3D mesh to 2D image: quadrilaterals are split into triangles,
+// binned into screen tiles, and the tiles are rasterized in parallel
+void ImageFactory::flatten(Vector<double>& source, int num_threads)
 {
+    PerfScope perf("rasterize", long(image_height) * image_width, true);
+
     Matrix img(image_height, image_width);
+    Matrix height_derivatives_local(2 * image_height, image_width);
+    Matrix depth(image_height, image_width, -HUGE_VAL);
 
-    int s1, s2, s3;
-    Vector<double> v1(3), v2(3), v3(3);
+    const Vec3d light{{ source(1), source(2), source(3) }};
 
-    Matrix height_derivatives_local(2 * image_height, image_width);
+    // Gather triangles (two per quadrilateral)
+    std::vector<ScreenTriangle> primitives;
+    primitives.reserve(2 * num_quadrilaterals + num_triangles);
 
-    // Iterate over mesh quadrilaterals
-    for (int i = 0; i < num_quadrilaterals; i++)
+    auto addTriangle = [&](int s1, int s2, int s3)
     {
-        s1 = static_cast<int>(quadrilaterals(i + 1, 1));
-        s2 = static_cast<int>(quadrilaterals(i + 1, 2));
-        s3 = static_cast<int>(quadrilaterals(i + 1, 3));
+        ScreenTriangle t;
+        t.v[0] = vertices[s1 - 1];
+        t.v[1] = vertices[s2 - 1];
+        t.v[2] = vertices[s3 - 1];
+
+        // Normal: cross product of two edges, oriented towards +z
+        t.n = cross(t.v[1] - t.v[0], t.v[2] - t.v[0]);
+
+        // Faces seen edge-on cover no pixel
+        if (t.n(3) == 0.0)
+            return;
 
-        // Two edges of the quadrilateral
-        v1(1) = vertices(s1, 1) - vertices(s2, 1);
-        v1(2) = vertices(s1, 2) - vertices(s2, 2);
-        v1(3) = vertices(s1, 3) - vertices(s2, 3);
+        t.n = normalize(t.n);
+        if (t.n(3) < 0.0)
+            t.n = t.n * -1.0;
 
-        v2(1) = vertices(s3, 1) - vertices(s2, 1);
-        v2(2) = vertices(s3, 2) - vertices(s2, 2);
-        v2(3) = vertices(s3, 3) - vertices(s2, 3);
+        primitives.push_back(t);
+    };
 
-        // Mesh normal: cross product of two edges
-        v3 = v1 ^ v2;
-        v3 /= v3.norm();
+    for (const Vec<int, 4>& Q : quadrilaterals)
+    {
+        addTriangle(Q(1), Q(2), Q(3));
+        addTriangle(Q(1), Q(3), Q(4));
+    }
+
+    for (const Vec<int, 3>& T : triangles)
+        addTriangle(T(1), T(2), T(3));
+
+    // Bin triangles into the screen tiles their bounding box overlaps
+    int tiles_x = (image_width + tile_size - 1) / tile_size;
+    int tiles_y = (image_height + tile_size - 1) / tile_size;
+    int num_tiles = tiles_x * tiles_y;
+
+    std::vector<std::vector<int>> bins(num_tiles);
+
+    for (int i = 0; i < static_cast<int>(primitives.size()); i++)
+    {
+        const ScreenTriangle& t = primitives[i];
+
+        double x_lo = std::min(t.v[0](1), std::min(t.v[1](1), t.v[2](1))) - origin_x;
+        double x_hi = std::max(t.v[0](1), std::max(t.v[1](1), t.v[2](1))) - origin_x;
+        double y_lo = std::min(t.v[0](2), std::min(t.v[1](2), t.v[2](2))) - origin_y;
+        double y_hi = std::max(t.v[0](2), std::max(t.v[1](2), t.v[2](2))) - origin_y;
+
+        int tr0 = std::max(0, static_cast<int>(std::floor(x_lo)) / tile_size);
+        int tr1 = std::min(tiles_y - 1, static_cast<int>(std::floor(x_hi)) / tile_size);
+        int tc0 = std::max(0, static_cast<int>(std::floor(y_lo)) / tile_size);
+        int tc1 = std::min(tiles_x - 1, static_cast<int>(std::floor(y_hi)) / tile_size);
+
+        for (int tr = tr0; tr <= tr1; tr++)
+            for (int tc = tc0; tc <= tc1; tc++)
+                bins[tr * tiles_x + tc].push_back(i);
+    }
 
-        // Grayscale intensity (assumed constant per quadrilateral)
-        img.values[i / image_height][i % image_width] =
-            std::abs(255.0 * (source * v3));
+    // Rasterize the tiles in parallel, each thread pulling the next free tile
+    if (num_threads <= 0)
+        num_threads = std::max(1u, std::thread::hardware_concurrency());
 
-        // Directional derivatives of height
-        height_derivatives_local.values[i / image_width][i % image_width] =
-            -v3(1) / v3(3);
+    std::atomic<int> next_tile(0);
+    std::vector<std::thread> workers;
 
-        height_derivatives_local.values[(i / image_width) + image_height][i % image_width] =
-            -v3(2) / v3(3);
+    for (int w = 0; w < num_threads; w++)
+    {
+        workers.emplace_back([&]()
+        {
+            for (int tile = next_tile++; tile < num_tiles; tile = next_tile++)
+                rasterizeTile(tile, primitives, bins, tiles_x, tile_size,
+                              origin_x, origin_y, light,
+                              depth, img, height_derivatives_local);
+        });
     }
 
+    for (std::thread& worker : workers)
+        worker.join();
+
     height_derivatives = height_derivatives_local;
     image = img;
 }
@@ -125,18 +300,53 @@ void ImageFactory::save2D(const char* filename)
 }
 
 // Read CSV file into a matrix
-Matrix csvToMatrix(const char* csv_file)
+bool readCsvMatrix(const char* csv_file, Matrix& M, std::string& error, long max_pixels)
 {
     std::ifstream csv(csv_file, std::ios::in);
 
+    if (!csv)
+    {
+        error = std::string("unable to open image ") + csv_file;
+        return false;
+    }
+
     int rows, cols;
-    csv >> rows >> cols;
+    if (!(csv >> rows >> cols) || rows < 1 || cols < 1)
+    {
+        error = std::string("bad image size in ") + csv_file;
+        return false;
+    }
 
-    Matrix M(rows, cols);
+    if (max_pixels >= 0 && long(rows) * cols > max_pixels)
+    {
+        error = std::string("image too large: ") + csv_file;
+        return false;
+    }
+
+    Matrix image(rows, cols);
 
     for (int i = 0; i < rows; i++)
         for (int j = 0; j < cols; j++)
-            csv >> M.values[i][j];
+            if (!(csv >> image.values[i][j]))
+            {
+                error = std::string("truncated or malformed image ") + csv_file;
+                return false;
+            }
+
+    M = std::move(image);
+    return true;
+}
+
+Matrix csvToMatrix(const char* csv_file)
+{
+    Matrix M;
+    std::string error;
+
+    if (!readCsvMatrix(csv_file, M, error))
+    {
+        std::cerr << "Error: " << error << ".\n";
+        std::exit(1);
+    }
 
     return M;
 }
@@ -0,0 +1,315 @@
+// Shading energy on the interleaved layout of the unknowns,
+// x = (p0, q0, p1, q1, ...): the two slopes of a pixel are adjacent, so
+// each stencil reads (and the gradient writes) one stream instead of two
+// distant ones. Same energy, same gradient formula and same summation
+// order as objective_function.cpp / objective_gradient.cpp /
+// line_search.cpp; L-BFGS itself is layout-agnostic.
+
+#include "../include/reflectance.hpp"
+#include "../include/matrix.hpp"
+#include "../include/vector.hpp"
+#include "../include/globals.hpp"
+#include "../include/perf_counters.hpp"
+
+Vector<double> interleaveSlopes(const Vector<double>& x)
+{
+    int n = x.dimension / 2;
+    Vector<double> result(x.dimension);
+
+    for (int k = 0; k < n; k++)
+    {
+        result.values[2 * k] = x.values[k];
+        result.values[2 * k + 1] = x.values[n + k];
+    }
+
+    return result;
+}
+
+Vector<double> splitSlopes(const Vector<double>& x)
+{
+    int n = x.dimension / 2;
+    Vector<double> result(x.dimension);
+
+    for (int k = 0; k < n; k++)
+    {
+        result.values[k] = x.values[2 * k];
+        result.values[n + k] = x.values[2 * k + 1];
+    }
+
+    return result;
+}
+
+template <typename Model, typename Image>
+double interleavedShadingObjective(const Vector<double>& x, const ShadingData<Model, Image>& data)
+{
+    const Image& image = *data.image;
+    const EnergyWeights& weights = data.weights;
+    int rows = image.rows;
+    int cols = image.cols;
+    PerfScope perf("interleaved objective", long(rows) * cols);
+
+    const double* u = x.values;
+
+    double data_term = 0.0;
+    double integrability_term = 0.0;
+    double smoothness_term = 0.0;
+
+    for (int i = 0; i < rows; i++)
+    {
+        for (int j = 0; j < cols; j++)
+        {
+            // (p, q) of the pixel, its right and its lower neighbour
+            const double* c = u + 2 * (i * cols + j);
+
+            double r = greyLevel(image, i, j) - data.model.radiance(c[0], c[1]);
+            data_term += r * r;
+
+            if (i != rows - 1 && j != cols - 1)
+            {
+                const double* right = c + 2;
+                const double* down = c + 2 * cols;
+
+                double e = right[0] - c[0] - down[1] + c[1];
+                integrability_term += e * e;
+
+                double a = down[0] - c[0], b = right[0] - c[0];
+                double f = right[1] - c[1], g = down[1] - c[1];
+                smoothness_term += a * a + b * b + f * f + g * g;
+            }
+        }
+    }
+
+    data_term *= weights.step_size * weights.step_size;
+    integrability_term *= weights.lambda_internal;
+    smoothness_term *= weights.lambda_csmo;
+
+    return data_term + integrability_term + smoothness_term;
+}
+
+// One pass: both gradient entries of a pixel are written together
+template <typename Model, typename Image>
+Vector<double> interleavedShadingGradient(const Vector<double>& x, const ShadingData<Model, Image>& data)
+{
+    const Image& image = *data.image;
+    const EnergyWeights& weights = data.weights;
+    int rows = image.rows;
+    int cols = image.cols;
+    PerfScope perf("interleaved gradient", long(rows) * cols);
+
+    const double* u = x.values;
+    Vector<double> gradient(x.dimension);
+    double* g = gradient.values;
+
+    double data_weight = weights.step_size * weights.step_size;
+    double R, R_p, R_q;
+
+    for (int i = 0; i < rows; i++)
+    {
+        for (int j = 0; j < cols; j++)
+        {
+            int k = 2 * (i * cols + j);
+            const double* c = u + k;
+
+            data.model.shade(c[0], c[1], R, R_p, R_q);
+
+            double residual = R - greyLevel(image, i, j);
+            double gp = residual * R_p * data_weight;
+            double gq = residual * R_q * data_weight;
+
+            if (i != 0 && j != 0 && i != rows - 1 && j != cols - 1)
+            {
+                const double* left = c - 2;
+                const double* right = c + 2;
+                const double* up = c - 2 * cols;
+                const double* down = c + 2 * cols;
+                const double* down_left = down - 2;
+                const double* up_right = up + 2;
+
+                double integrability_p =
+                    2 * c[0] - left[0] - right[0]
+                    - c[1] + down[1]
+                    - down_left[1] + left[1];
+
+                double smoothness_p =
+                    4 * c[0] - up[0] - down[0]
+                    - left[0] - right[0];
+
+                double integrability_q =
+                    2 * c[1]
+                    - up[1]
+                    - down[1]
+                    - c[0]
+                    + right[0]
+                    - up_right[0]
+                    + up[0];
+
+                double smoothness_q =
+                    4 * c[1]
+                    - up[1]
+                    - down[1]
+                    - left[1]
+                    - right[1];
+
+                gp = gp + integrability_p * weights.lambda_internal + smoothness_p * weights.lambda_csmo;
+                gq = gq + integrability_q * weights.lambda_internal + smoothness_q * weights.lambda_csmo;
+            }
+
+            g[k] = gp * 2;
+            g[k + 1] = gq * 2;
+        }
+    }
+
+    return gradient;
+}
+
+// Add (r + alpha e)² to the coefficients
+static inline void accumulate(LineModel& line, double r, double e)
+{
+    line.constant += r * r;
+    line.linear += 2.0 * r * e;
+    line.quadratic += e * e;
+}
+
+template <typename Model, typename Image>
+LineModel interleavedShadingLinePrepare(
+    const Vector<double>& x,
+    const Vector<double>& d,
+    const ShadingData<Model, Image>& data
+)
+{
+    const EnergyWeights& weights = data.weights;
+    int rows = data.image->rows;
+    int cols = data.image->cols;
+    PerfScope perf("interleaved line prepare", long(rows) * cols);
+
+    LineModel integrability = { 0.0, 0.0, 0.0 };
+    LineModel smoothness = { 0.0, 0.0, 0.0 };
+
+    for (int i = 0; i < rows - 1; i++)
+    {
+        for (int j = 0; j < cols - 1; j++)
+        {
+            int k = 2 * (i * cols + j);
+            int right = k + 2;
+            int down = k + 2 * cols;
+
+            const double* u = x.values;
+            const double* v = d.values;
+
+            accumulate(integrability,
+                       u[right] - u[k] - u[down + 1] + u[k + 1],
+                       v[right] - v[k] - v[down + 1] + v[k + 1]);
+
+            accumulate(smoothness, u[down] - u[k], v[down] - v[k]);
+            accumulate(smoothness, u[right] - u[k], v[right] - v[k]);
+            accumulate(smoothness, u[right + 1] - u[k + 1], v[right + 1] - v[k + 1]);
+            accumulate(smoothness, u[down + 1] - u[k + 1], v[down + 1] - v[k + 1]);
+        }
+    }
+
+    LineModel line;
+    line.constant = weights.lambda_internal * integrability.constant + weights.lambda_csmo * smoothness.constant;
+    line.linear = weights.lambda_internal * integrability.linear + weights.lambda_csmo * smoothness.linear;
+    line.quadratic = weights.lambda_internal * integrability.quadratic + weights.lambda_csmo * smoothness.quadratic;
+
+    return line;
+}
+
+template <typename Model, typename Image>
+double interleavedShadingLineRemainder(
+    const Vector<double>& x,
+    const Vector<double>& d,
+    double alpha,
+    const ShadingData<Model, Image>& data,
+    double& slope
+)
+{
+    const Image& image = *data.image;
+    const EnergyWeights& weights = data.weights;
+    PerfScope perf("interleaved line remainder", long(image.rows) * image.cols);
+
+    double value = 0.0;
+    double R, R_p, R_q;
+    slope = 0.0;
+
+    for (int i = 0; i < image.rows; i++)
+    {
+        for (int j = 0; j < image.cols; j++)
+        {
+            int k = 2 * (i * image.cols + j);
+            double dp = d.values[k];
+            double dq = d.values[k + 1];
+
+            data.model.shade(x.values[k] + alpha * dp, x.values[k + 1] + alpha * dq, R, R_p, R_q);
+
+            double r = greyLevel(image, i, j) - R;
+            value += r * r;
+            slope -= 2.0 * r * (R_p * dp + R_q * dq);
+        }
+    }
+
+    value *= weights.step_size * weights.step_size;
+    slope *= weights.step_size * weights.step_size;
+
+    return value;
+}
+
+template double interleavedShadingObjective(const Vector<double>&, const ShadingData<FrontalLambertian>&);
+template double interleavedShadingObjective(const Vector<double>&, const ShadingData<Lambertian>&);
+template double interleavedShadingObjective(const Vector<double>&, const ShadingData<LommelSeeliger>&);
+template double interleavedShadingObjective(const Vector<double>&, const ShadingData<HapkeLite>&);
+
+template double interleavedShadingObjective(const Vector<double>&, const ShadingData<FrontalLambertian, SensorImage<uint8_t>>&);
+template double interleavedShadingObjective(const Vector<double>&, const ShadingData<Lambertian, SensorImage<uint8_t>>&);
+template double interleavedShadingObjective(const Vector<double>&, const ShadingData<LommelSeeliger, SensorImage<uint8_t>>&);
+template double interleavedShadingObjective(const Vector<double>&, const ShadingData<HapkeLite, SensorImage<uint8_t>>&);
+
+template double interleavedShadingObjective(const Vector<double>&, const ShadingData<FrontalLambertian, SensorImage<uint16_t>>&);
+template double interleavedShadingObjective(const Vector<double>&, const ShadingData<Lambertian, SensorImage<uint16_t>>&);
+template double interleavedShadingObjective(const Vector<double>&, const ShadingData<LommelSeeliger, SensorImage<uint16_t>>&);
+template double interleavedShadingObjective(const Vector<double>&, const ShadingData<HapkeLite, SensorImage<uint16_t>>&);
+
+template Vector<double> interleavedShadingGradient(const Vector<double>&, const ShadingData<FrontalLambertian>&);
+template Vector<double> interleavedShadingGradient(const Vector<double>&, const ShadingData<Lambertian>&);
+template Vector<double> interleavedShadingGradient(const Vector<double>&, const ShadingData<LommelSeeliger>&);
+template Vector<double> interleavedShadingGradient(const Vector<double>&, const ShadingData<HapkeLite>&);
+
+template Vector<double> interleavedShadingGradient(const Vector<double>&, const ShadingData<FrontalLambertian, SensorImage<uint8_t>>&);
+template Vector<double> interleavedShadingGradient(const Vector<double>&, const ShadingData<Lambertian, SensorImage<uint8_t>>&);
+template Vector<double> interleavedShadingGradient(const Vector<double>&, const ShadingData<LommelSeeliger, SensorImage<uint8_t>>&);
+template Vector<double> interleavedShadingGradient(const Vector<double>&, const ShadingData<HapkeLite, SensorImage<uint8_t>>&);
+
+template Vector<double> interleavedShadingGradient(const Vector<double>&, const ShadingData<FrontalLambertian, SensorImage<uint16_t>>&);
+template Vector<double> interleavedShadingGradient(const Vector<double>&, const ShadingData<Lambertian, SensorImage<uint16_t>>&);
+template Vector<double> interleavedShadingGradient(const Vector<double>&, const ShadingData<LommelSeeliger, SensorImage<uint16_t>>&);
+template Vector<double> interleavedShadingGradient(const Vector<double>&, const ShadingData<HapkeLite, SensorImage<uint16_t>>&);
+
+template LineModel interleavedShadingLinePrepare(const Vector<double>&, const Vector<double>&, const ShadingData<FrontalLambertian>&);
+template LineModel interleavedShadingLinePrepare(const Vector<double>&, const Vector<double>&, const ShadingData<Lambertian>&);
+template LineModel interleavedShadingLinePrepare(const Vector<double>&, const Vector<double>&, const ShadingData<LommelSeeliger>&);
+template LineModel interleavedShadingLinePrepare(const Vector<double>&, const Vector<double>&, const ShadingData<HapkeLite>&);
+
+template LineModel interleavedShadingLinePrepare(const Vector<double>&, const Vector<double>&, const ShadingData<FrontalLambertian, SensorImage<uint8_t>>&);
+template LineModel interleavedShadingLinePrepare(const Vector<double>&, const Vector<double>&, const ShadingData<Lambertian, SensorImage<uint8_t>>&);
+template LineModel interleavedShadingLinePrepare(const Vector<double>&, const Vector<double>&, const ShadingData<LommelSeeliger, SensorImage<uint8_t>>&);
+template LineModel interleavedShadingLinePrepare(const Vector<double>&, const Vector<double>&, const ShadingData<HapkeLite, SensorImage<uint8_t>>&);
+
+template LineModel interleavedShadingLinePrepare(const Vector<double>&, const Vector<double>&, const ShadingData<FrontalLambertian, SensorImage<uint16_t>>&);
+template LineModel interleavedShadingLinePrepare(const Vector<double>&, const Vector<double>&, const ShadingData<Lambertian, SensorImage<uint16_t>>&);
+template LineModel interleavedShadingLinePrepare(const Vector<double>&, const Vector<double>&, const ShadingData<LommelSeeliger, SensorImage<uint16_t>>&);
+template LineModel interleavedShadingLinePrepare(const Vector<double>&, const Vector<double>&, const ShadingData<HapkeLite, SensorImage<uint16_t>>&);
+
+template double interleavedShadingLineRemainder(const Vector<double>&, const Vector<double>&, double, const ShadingData<FrontalLambertian>&, double&);
+template double interleavedShadingLineRemainder(const Vector<double>&, const Vector<double>&, double, const ShadingData<Lambertian>&, double&);
+template double interleavedShadingLineRemainder(const Vector<double>&, const Vector<double>&, double, const ShadingData<LommelSeeliger>&, double&);
+template double interleavedShadingLineRemainder(const Vector<double>&, const Vector<double>&, double, const ShadingData<HapkeLite>&, double&);
+
+template double interleavedShadingLineRemainder(const Vector<double>&, const Vector<double>&, double, const ShadingData<FrontalLambertian, SensorImage<uint8_t>>&, double&);
+template double interleavedShadingLineRemainder(const Vector<double>&, const Vector<double>&, double, const ShadingData<Lambertian, SensorImage<uint8_t>>&, double&);
+template double interleavedShadingLineRemainder(const Vector<double>&, const Vector<double>&, double, const ShadingData<LommelSeeliger, SensorImage<uint8_t>>&, double&);
+template double interleavedShadingLineRemainder(const Vector<double>&, const Vector<double>&, double, const ShadingData<HapkeLite, SensorImage<uint8_t>>&, double&);
+
+template double interleavedShadingLineRemainder(const Vector<double>&, const Vector<double>&, double, const ShadingData<FrontalLambertian, SensorImage<uint16_t>>&, double&);
+template double interleavedShadingLineRemainder(const Vector<double>&, const Vector<double>&, double, const ShadingData<Lambertian, SensorImage<uint16_t>>&, double&);
+template double interleavedShadingLineRemainder(const Vector<double>&, const Vector<double>&, double, const ShadingData<LommelSeeliger, SensorImage<uint16_t>>&, double&);
+template double interleavedShadingLineRemainder(const Vector<double>&, const Vector<double>&, double, const ShadingData<HapkeLite, SensorImage<uint16_t>>&, double&);
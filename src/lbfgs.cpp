@@ -1,121 +1,648 @@
 #include "../include/lbfgs.hpp"
+#include "../include/active_domain.hpp"
+#include "../include/distributed.hpp"
+#include "../include/reflectance.hpp"
 #include "../include/matrix.hpp"
 #include "../include/vector.hpp"
+#include "../include/arena.hpp"
+#include "../include/blas1.hpp"
+#include "../include/trial_pool.hpp"
 
 #include <cmath>
 #include <iostream>
+#include <memory>
+
+// Totals of partial sums over the shares of a distributed solve (no-op
+// when the vectors hold the whole problem)
+static void reduceSums(const LBFGSControl* control, double* values, int count)
+{
+    if (control && control->reduce)
+        control->reduce(values, count);
+}
+
+// Evaluate the objective; the evaluation's temporaries are dropped from
+// the arena right after
+template <typename Data>
+static double evaluateObjective(
+    double (*objective)(const Vector<double>&, const Data&),
+    const Vector<double>& x,
+    const Data& M,
+    FrameArena& arena
+)
+{
+    FrameArena::Mark mark = arena.mark();
+    double value = objective(x, M);
+    arena.rewind(mark);
+    return value;
+}
+
+// Evaluate the gradient into out (already sized), same arena discipline
+template <typename Data>
+static void evaluateGradient(
+    Vector<double> (*objectiveGradient)(const Vector<double>&, const Data&),
+    const Vector<double>& x,
+    const Data& M,
+    FrameArena& arena,
+    Vector<double>& out
+)
+{
+    FrameArena::Mark mark = arena.mark();
+    {
+        Vector<double> g = objectiveGradient(x, M);
+        for (int i = 0; i < out.dimension; i++)
+            out.values[i] = g.values[i];
+    }
+    arena.rewind(mark);
+}
+
+// Objective and its slope along d at the trial point x + step d. With a
+// line restriction only the non-quadratic remainder is evaluated; otherwise
+// the objective and gradient are, at x_trial / g_trial (already sized)
+template <typename Data>
+static void evaluateTrial(
+    double (*objective)(const Vector<double>&, const Data&),
+    Vector<double> (*objectiveGradient)(const Vector<double>&, const Data&),
+    const LineSearch<Data>* line,
+    const LineModel& model,
+    const Vector<double>& x,
+    const Vector<double>& d,
+    double step,
+    const Data& M,
+    const LBFGSControl* control,
+    FrameArena& arena,
+    Vector<double>& x_trial,
+    Vector<double>& g_trial,
+    double& f_trial,
+    double& slope_trial
+)
+{
+    if (line)
+    {
+        // Quadratic terms in O(1), remainder in one pass
+        f_trial = line->remainder(x, d, step, M, slope_trial);
+        f_trial += model.constant + step * (model.linear + step * model.quadratic);
+        slope_trial += model.linear + 2.0 * step * model.quadratic;
+    }
+    else
+    {
+        for (int i = 0; i < x.dimension; i++)
+            x_trial.values[i] = x.values[i] + step * d.values[i];
+
+        f_trial = evaluateObjective(objective, x_trial, M, arena);
+        evaluateGradient(objectiveGradient, x_trial, M, arena, g_trial);
+        slope_trial = g_trial * d;
+        reduceSums(control, &slope_trial, 1);
+    }
+}
 
 // Implementation of the L-BFGS gradient descent algorithm
+template <typename Data>
 Vector<double> LBFGS(
     Vector<double>& x,
-    double (*objective)(const Vector<double>&, const Matrix&),
-    Vector<double> (*objectiveGradient)(const Vector<double>&, const Matrix&),
-    const Matrix& M,
-    double epsilon
+    double (*objective)(const Vector<double>&, const Data&),
+    Vector<double> (*objectiveGradient)(const Vector<double>&, const Data&),
+    const Data& M,
+    double epsilon,
+    const LineSearch<Data>* line,
+    LBFGSControl* control
 )
 {
-    DiagonalMatrix identity(x.dimension, 1.0);
-
     double gamma = 1.0;      // scaling factor
-    int memory = 5;          // number of stored iterations (m)
+    int memory = control ? control->memory : 5;   // number of stored iterations (m)
     int iteration = 0;       // iteration counter
     int wolfe_max = 20;      // max iterations for Wolfe line search
 
+    // State kept across iterations lives on the heap; everything else is
+    // drawn from the workspace arena, which is reset at every iteration
+    FrameArena own_workspace;
+    FrameArena& workspace = (control && control->workspace) ? *control->workspace : own_workspace;
+
     Vector<Vector<double>> s(memory);
     Vector<Vector<double>> y(memory);
     Vector<double> alpha_coeff(memory, 0.0);
+    Vector<double> rho(memory, 0.0);             // 1 / (y · s) of each stored pair
+
+    for (int k = 0; k < memory; k++)
+    {
+        s.values[k] = Vector<double>(x.dimension);
+        y.values[k] = Vector<double>(x.dimension);
+    }
 
     double beta;
     double c1 = std::pow(10.0, -4);
     double c2 = 0.9999999;
 
+    bool verbose = !control || control->verbose;
+    int kernel_threads = control ? control->kernel_threads : 1;
+    int n = x.dimension;
+
+    // Anytime state: best iterate and recent objective values
+    LBFGSControl::Clock::time_point start = LBFGSControl::Clock::now();
+    bool anytime = control && control->has_deadline;
+    bool stall_check = control && control->min_decrease > 0.0 && control->window > 0;
+
+    Vector<double> x_best;
+    double f_best = HUGE_VAL;
+    if (anytime)
+        x_best = Vector<double>(x.dimension);
+
+    Vector<double> history;
+    if (stall_check)
+        history = Vector<double>(control->window, 0.0);
+
+    // Speculative line search: trial steps step, step / 2, ... evaluated
+    // together on the caller's pool (or one started for this solve), each
+    // thread with its own arena (and, without a line restriction, its own
+    // point and gradient)
+    int trials = (control && control->parallel_trials > 1 && !control->reduce) ? control->parallel_trials : 1;
+
+    std::unique_ptr<TrialPool> own_pool;
+    TrialPool* trial_pool = nullptr;
+    Vector<Vector<double>> x_trials;
+    Vector<Vector<double>> g_trials;
+    Vector<double> f_trials;
+    Vector<double> slope_trials;
+
+    if (trials > 1)
+    {
+        trial_pool = control->trial_pool;
+        if (!trial_pool || trial_pool->size() < trials - 1)
+        {
+            own_pool.reset(new TrialPool(trials - 1));
+            trial_pool = own_pool.get();
+        }
+
+        x_trials = Vector<Vector<double>>(trials);
+        g_trials = Vector<Vector<double>>(trials);
+        f_trials = Vector<double>(trials);
+        slope_trials = Vector<double>(trials);
+
+        for (int t = 0; t < trials && !line; t++)
+        {
+            x_trials.values[t] = Vector<double>(x.dimension);
+            g_trials.values[t] = Vector<double>(x.dimension);
+        }
+    }
+
+    const char* stop_reason = "iterations";
+    bool out_of_time = false;
+    double f_current = HUGE_VAL;    // objective at x, once known
+    bool f_known = false;
+    double gradient_norm = 0.0;
+
     while (true)
     {
-        std::cout << "Iteration: " << iteration << "\n";
+        workspace.reset();
+        ArenaScope scope(workspace);
 
-        Vector<double> gradient = objectiveGradient(x, M);
-        Vector<double> q = gradient;
+        if (verbose)
+            std::cout << "Iteration: " << iteration << "\n";
 
-        std::cout << "Gradient norm: " << gradient.norm() << "\n";
+        Vector<double> gradient(x.dimension);
+        evaluateGradient(objectiveGradient, x, M, workspace, gradient);
 
-        if (gradient.norm() < epsilon || iteration == 10000)
-            return x;
+        // Pairs of the two loops of the recursion below: (first_low,
+        // first_high] newest first, then [second_low, iteration)
+        int first_high = iteration - 1;
+        int first_low = std::max(iteration - memory - 1, 0);
+        int second_low = std::max(iteration - memory, 0);
 
-        if (iteration > 0)
+        // Gradient norm and the first dot product of the recursion in one
+        // pass, reduced together with the cancel and deadline votes so that
+        // every share of a distributed solve stops on the same iteration
+        double sums[4] = { 0.0, 0.0, 0.0, 0.0 };
+        if (first_high > first_low)
+            dot2(n, gradient.values, gradient.values, s.values[first_high % memory].values,
+                 sums[0], sums[1], kernel_threads);
+        else
+            sums[0] = dot(n, gradient.values, gradient.values, kernel_threads);
+
+        if (control && control->cancel && control->cancel->load(std::memory_order_relaxed))
+            sums[2] = 1.0;
+        if (anytime && LBFGSControl::Clock::now() >= control->deadline)
+            sums[3] = 1.0;
+
+        reduceSums(control, sums, 4);
+
+        double next_dot = sums[1];
+        gradient_norm = std::sqrt(sums[0]);
+        if (verbose)
+            std::cout << "Gradient norm: " << gradient_norm << "\n";
+
+        if (gradient_norm < epsilon)
         {
-            gamma =
-                (s.values[(iteration - 1) % memory] *
-                 y.values[(iteration - 1) % memory]) /
-                (y.values[(iteration - 1) % memory] *
-                 y.values[(iteration - 1) % memory]);
+            stop_reason = "gradient";
+            break;
         }
 
-        // Initial Hessian inverse approximation
-        DiagonalMatrix H0 = identity * gamma;
+        if (iteration == 10000)
+            break;
 
-        // Two-loop recursion (descent direction computation)
-        for (int i = std::max(iteration - 1, 0);
-             i > std::max(iteration - memory - 1, 0);
-             i--)
+        if (sums[2] > 0.0)
         {
-            alpha_coeff.values[i % memory] =
-                (1.0 / (y.values[i % memory] * s.values[i % memory])) *
-                (s.values[i % memory] * q);
+            stop_reason = "cancelled";
+            break;
+        }
 
-            q = q - y.values[i % memory] * alpha_coeff.values[i % memory];
+        if (sums[3] > 0.0)
+        {
+            stop_reason = "deadline";
+            out_of_time = true;
+            break;
         }
 
-        Vector<double> r = H0 * q;
+        // Two-loop recursion (descent direction computation), carried out
+        // on -r so that no final negation is needed. Each pass updates the
+        // vector and takes the dot product the following step needs.
+        Vector<double> descent_direction(x.dimension);
+        double* d = descent_direction.values;
+        const double* source = gradient.values;
+
+        // Dot product partner of the scaled vector: the second loop's first y
+        const double* second_first = (second_low < iteration) ? y.values[second_low % memory].values : nullptr;
 
-        for (int i = std::max(iteration - memory, 0);
-             i < std::max(iteration, 0);
-             i++)
+        for (int i = first_high; i > first_low; i--)
         {
-            beta =
-                (1.0 / (y.values[i % memory] * s.values[i % memory])) *
-                (y.values[i % memory] * r);
+            int k = i % memory;
+            alpha_coeff.values[k] = rho.values[k] * next_dot;
 
-            r = r + s.values[i % memory] *
-                    (alpha_coeff.values[i % memory] - beta);
+            // The last pass also applies the initial Hessian inverse
+            // approximation, gamma * identity (negated)
+            if (i - 1 > first_low)
+                next_dot = axpyDot(n, -alpha_coeff.values[k], y.values[k].values, source, d,
+                                   s.values[(i - 1) % memory].values, kernel_threads);
+            else
+                next_dot = axpyScaleDot(n, -alpha_coeff.values[k], y.values[k].values, source, -gamma, d,
+                                        second_first, kernel_threads);
+            reduceSums(control, &next_dot, 1);
+            source = d;
         }
 
-        Vector<double> descent_direction = r * -1.0;
+        if (first_high <= first_low)
+        {
+            next_dot = scaleDot(n, -gamma, gradient.values, d, second_first, kernel_threads);
+            reduceSums(control, &next_dot, 1);
+        }
+
+        for (int i = second_low; i < iteration; i++)
+        {
+            int k = i % memory;
+            beta = -rho.values[k] * next_dot;
+
+            const double* next_y = (i + 1 < iteration) ? y.values[(i + 1) % memory].values : nullptr;
+            next_dot = axpyDot(n, beta - alpha_coeff.values[k], s.values[k].values, d, d,
+                               next_y, kernel_threads);
+            if (next_y)
+                reduceSums(control, &next_dot, 1);
+        }
 
         // Wolfe line search
         double step = 1.0;
-        double f0 = objective(x, M);
+        double f0;
+        double directional_derivative;
+        LineModel model = { 0.0, 0.0, 0.0 };
 
-        std::cout << "Objective value: " << f0 << "\n";
+        if (line)
+        {
+            // Quadratic terms along the direction, computed once
+            model = line->prepare(x, descent_direction, M);
+            f0 = model.constant;
+            directional_derivative = model.linear;
 
-        double directional_derivative = gradient * descent_direction;
-        int wolfe_iter = 0;
+            if (line->remainder)
+            {
+                double slope;
+                f0 += line->remainder(x, descent_direction, 0.0, M, slope);
+                directional_derivative += slope;
+            }
+        }
+        else
+        {
+            f0 = evaluateObjective(objective, x, M, workspace);
+            directional_derivative = gradient * descent_direction;
+            reduceSums(control, &directional_derivative, 1);
+        }
+
+        if (verbose)
+            std::cout << "Objective value: " << f0 << "\n";
+
+        f_current = f0;
+        f_known = true;
 
-        while (true)
+        if (anytime && f0 < f_best)
         {
-            Vector<double> x_trial = x + descent_direction * step;
-            double f_trial = objective(x_trial, M);
-            Vector<double> g_trial = objectiveGradient(x_trial, M);
+            f_best = f0;
+            for (int i = 0; i < x.dimension; i++)
+                x_best.values[i] = x.values[i];
+        }
 
-            if ((f_trial <= f0 + c1 * step * directional_derivative &&
-                 std::abs(g_trial * descent_direction) <=
-                     c2 * std::abs(directional_derivative)) ||
-                wolfe_iter > wolfe_max)
+        if (stall_check)
+        {
+            // Relative decrease over the last window iterations
+            double& f_old = history.values[iteration % control->window];
+            if (iteration >= control->window &&
+                f_old - f0 < control->min_decrease * std::abs(f_old))
             {
+                stop_reason = "stalled";
                 break;
             }
+            f_old = f0;
+        }
+
+        // Objective at the accepted step, the next iterate
+        double f_next;
+
+        if (line && !line->remainder)
+        {
+            // Quadratic objective: exact minimizer along the direction
+            if (model.quadratic > 0.0)
+                step = -model.linear / (2.0 * model.quadratic);
+            f_next = model.constant + step * (model.linear + step * model.quadratic);
+        }
+        else if (trials > 1)
+        {
+            // Accept the largest step of each batch that satisfies the Wolfe
+            // conditions: the step the sequential search would take
+            int wolfe_iter = 0;
+
+            while (true)
+            {
+                trial_pool->run([&](int t)
+                {
+                    // Trial 0 runs on this thread, in the iteration's arena
+                    FrameArena& arena = t ? trial_pool->arena(t) : workspace;
+                    if (t)
+                        arena.reset();
+                    ArenaScope trial_scope(arena);
+
+                    evaluateTrial(objective, objectiveGradient, line, model, x, descent_direction,
+                                  std::ldexp(step, -t), M, control, arena,
+                                  x_trials.values[t], g_trials.values[t],
+                                  f_trials.values[t], slope_trials.values[t]);
+                }, trials);
+
+                int accepted = -1;
+                for (int t = 0; t < trials && accepted < 0; t++)
+                {
+                    double trial_step = std::ldexp(step, -t);
+
+                    if ((f_trials.values[t] <= f0 + c1 * trial_step * directional_derivative &&
+                         std::abs(slope_trials.values[t]) <= c2 * std::abs(directional_derivative)) ||
+                        wolfe_iter + t > wolfe_max)
+                    {
+                        accepted = t;
+                    }
+                }
+
+                if (accepted >= 0)
+                {
+                    step = std::ldexp(step, -accepted);
+                    f_next = f_trials.values[accepted];
+                    break;
+                }
+
+                step = std::ldexp(step, -trials);
+                wolfe_iter += trials;
+            }
+        }
+        else
+        {
+            int wolfe_iter = 0;
+
+            // Point and gradient of a trial: not needed with a line restriction
+            Vector<double> x_trial(line ? 0 : x.dimension);
+            Vector<double> g_trial(line ? 0 : x.dimension);
+
+            while (true)
+            {
+                double f_trial;
+                double slope_trial;
 
-            step *= 0.5;
-            wolfe_iter++;
+                evaluateTrial(objective, objectiveGradient, line, model, x, descent_direction,
+                              step, M, control, workspace, x_trial, g_trial, f_trial, slope_trial);
+
+                if ((f_trial <= f0 + c1 * step * directional_derivative &&
+                     std::abs(slope_trial) <= c2 * std::abs(directional_derivative)) ||
+                    wolfe_iter > wolfe_max)
+                {
+                    f_next = f_trial;
+                    break;
+                }
+
+                step *= 0.5;
+                wolfe_iter++;
+            }
         }
 
-        Vector<double> x_next = x + descent_direction * step;
+        Vector<double> x_next(x.dimension);
+        axpyDot(n, step, descent_direction.values, x.values, x_next.values, nullptr, kernel_threads);
 
-        y.values[iteration % memory] =
-            objectiveGradient(x_next, M) - objectiveGradient(x, M);
+        Vector<double> g_next(x.dimension);
+        evaluateGradient(objectiveGradient, x_next, M, workspace, g_next);
 
-        s.values[iteration % memory] = x_next - x;
+        // New pair, with its curvature and the scaling of the next iteration
+        int k = iteration % memory;
+        double sy;
+        double yy;
+        differenceDots(n, x.values, x_next.values, gradient.values, g_next.values,
+                       s.values[k].values, y.values[k].values, sy, yy, kernel_threads);
+        double pair_dots[2] = { sy, yy };
+        reduceSums(control, pair_dots, 2);
+        sy = pair_dots[0];
+        yy = pair_dots[1];
+        rho.values[k] = 1.0 / sy;
+        gamma = sy / yy;
 
         x = x_next;
+        f_current = f_next;
         iteration++;
     }
+
+    if (verbose)
+        std::cout << "Workspace high-water mark (bytes): " << workspace.highWaterMark()
+                  << ", system allocations: " << workspace.systemAllocations() << "\n";
+
+    if (control)
+    {
+        // Stopped before any objective evaluation (gradient test at the
+        // starting point)
+        if (!f_known)
+            f_current = evaluateObjective(objective, x, M, workspace);
+
+        // Out of time: fall back on the best iterate if the last one is worse
+        if (out_of_time && f_best < f_current)
+        {
+            x = x_best;
+            f_current = f_best;
+        }
+
+        control->stop_reason = stop_reason;
+        control->iterations = iteration;
+        control->objective = f_current;
+        control->gradient_norm = gradient_norm;
+        control->seconds = std::chrono::duration<double>(LBFGSControl::Clock::now() - start).count();
+    }
+
+    return x;
 }
+
+// Explicit instantiations for the problem data used by the solvers
+template Vector<double> LBFGS<HeightData>(
+    Vector<double>&,
+    double (*)(const Vector<double>&, const HeightData&),
+    Vector<double> (*)(const Vector<double>&, const HeightData&),
+    const HeightData&,
+    double,
+    const LineSearch<HeightData>*,
+    LBFGSControl*
+);
+
+template Vector<double> LBFGS<BandData>(
+    Vector<double>&,
+    double (*)(const Vector<double>&, const BandData&),
+    Vector<double> (*)(const Vector<double>&, const BandData&),
+    const BandData&,
+    double,
+    const LineSearch<BandData>*,
+    LBFGSControl*
+);
+
+template Vector<double> LBFGS<RegionWindow>(
+    Vector<double>&,
+    double (*)(const Vector<double>&, const RegionWindow&),
+    Vector<double> (*)(const Vector<double>&, const RegionWindow&),
+    const RegionWindow&,
+    double,
+    const LineSearch<RegionWindow>*,
+    LBFGSControl*
+);
+
+template Vector<double> LBFGS<MaskedData>(
+    Vector<double>&,
+    double (*)(const Vector<double>&, const MaskedData&),
+    Vector<double> (*)(const Vector<double>&, const MaskedData&),
+    const MaskedData&,
+    double,
+    const LineSearch<MaskedData>*,
+    LBFGSControl*
+);
+
+template Vector<double> LBFGS<ShadingData<FrontalLambertian>>(
+    Vector<double>&,
+    double (*)(const Vector<double>&, const ShadingData<FrontalLambertian>&),
+    Vector<double> (*)(const Vector<double>&, const ShadingData<FrontalLambertian>&),
+    const ShadingData<FrontalLambertian>&,
+    double,
+    const LineSearch<ShadingData<FrontalLambertian>>*,
+    LBFGSControl*
+);
+
+template Vector<double> LBFGS<ShadingData<Lambertian>>(
+    Vector<double>&,
+    double (*)(const Vector<double>&, const ShadingData<Lambertian>&),
+    Vector<double> (*)(const Vector<double>&, const ShadingData<Lambertian>&),
+    const ShadingData<Lambertian>&,
+    double,
+    const LineSearch<ShadingData<Lambertian>>*,
+    LBFGSControl*
+);
+
+template Vector<double> LBFGS<ShadingData<LommelSeeliger>>(
+    Vector<double>&,
+    double (*)(const Vector<double>&, const ShadingData<LommelSeeliger>&),
+    Vector<double> (*)(const Vector<double>&, const ShadingData<LommelSeeliger>&),
+    const ShadingData<LommelSeeliger>&,
+    double,
+    const LineSearch<ShadingData<LommelSeeliger>>*,
+    LBFGSControl*
+);
+
+template Vector<double> LBFGS<ShadingData<HapkeLite>>(
+    Vector<double>&,
+    double (*)(const Vector<double>&, const ShadingData<HapkeLite>&),
+    Vector<double> (*)(const Vector<double>&, const ShadingData<HapkeLite>&),
+    const ShadingData<HapkeLite>&,
+    double,
+    const LineSearch<ShadingData<HapkeLite>>*,
+    LBFGSControl*
+);
+
+template Vector<double> LBFGS<ShadingData<FrontalLambertian, SensorImage<uint8_t>>>(
+    Vector<double>&,
+    double (*)(const Vector<double>&, const ShadingData<FrontalLambertian, SensorImage<uint8_t>>&),
+    Vector<double> (*)(const Vector<double>&, const ShadingData<FrontalLambertian, SensorImage<uint8_t>>&),
+    const ShadingData<FrontalLambertian, SensorImage<uint8_t>>&,
+    double,
+    const LineSearch<ShadingData<FrontalLambertian, SensorImage<uint8_t>>>*,
+    LBFGSControl*
+);
+
+template Vector<double> LBFGS<ShadingData<Lambertian, SensorImage<uint8_t>>>(
+    Vector<double>&,
+    double (*)(const Vector<double>&, const ShadingData<Lambertian, SensorImage<uint8_t>>&),
+    Vector<double> (*)(const Vector<double>&, const ShadingData<Lambertian, SensorImage<uint8_t>>&),
+    const ShadingData<Lambertian, SensorImage<uint8_t>>&,
+    double,
+    const LineSearch<ShadingData<Lambertian, SensorImage<uint8_t>>>*,
+    LBFGSControl*
+);
+
+template Vector<double> LBFGS<ShadingData<LommelSeeliger, SensorImage<uint8_t>>>(
+    Vector<double>&,
+    double (*)(const Vector<double>&, const ShadingData<LommelSeeliger, SensorImage<uint8_t>>&),
+    Vector<double> (*)(const Vector<double>&, const ShadingData<LommelSeeliger, SensorImage<uint8_t>>&),
+    const ShadingData<LommelSeeliger, SensorImage<uint8_t>>&,
+    double,
+    const LineSearch<ShadingData<LommelSeeliger, SensorImage<uint8_t>>>*,
+    LBFGSControl*
+);
+
+template Vector<double> LBFGS<ShadingData<HapkeLite, SensorImage<uint8_t>>>(
+    Vector<double>&,
+    double (*)(const Vector<double>&, const ShadingData<HapkeLite, SensorImage<uint8_t>>&),
+    Vector<double> (*)(const Vector<double>&, const ShadingData<HapkeLite, SensorImage<uint8_t>>&),
+    const ShadingData<HapkeLite, SensorImage<uint8_t>>&,
+    double,
+    const LineSearch<ShadingData<HapkeLite, SensorImage<uint8_t>>>*,
+    LBFGSControl*
+);
+
+template Vector<double> LBFGS<ShadingData<FrontalLambertian, SensorImage<uint16_t>>>(
+    Vector<double>&,
+    double (*)(const Vector<double>&, const ShadingData<FrontalLambertian, SensorImage<uint16_t>>&),
+    Vector<double> (*)(const Vector<double>&, const ShadingData<FrontalLambertian, SensorImage<uint16_t>>&),
+    const ShadingData<FrontalLambertian, SensorImage<uint16_t>>&,
+    double,
+    const LineSearch<ShadingData<FrontalLambertian, SensorImage<uint16_t>>>*,
+    LBFGSControl*
+);
+
+template Vector<double> LBFGS<ShadingData<Lambertian, SensorImage<uint16_t>>>(
+    Vector<double>&,
+    double (*)(const Vector<double>&, const ShadingData<Lambertian, SensorImage<uint16_t>>&),
+    Vector<double> (*)(const Vector<double>&, const ShadingData<Lambertian, SensorImage<uint16_t>>&),
+    const ShadingData<Lambertian, SensorImage<uint16_t>>&,
+    double,
+    const LineSearch<ShadingData<Lambertian, SensorImage<uint16_t>>>*,
+    LBFGSControl*
+);
+
+template Vector<double> LBFGS<ShadingData<LommelSeeliger, SensorImage<uint16_t>>>(
+    Vector<double>&,
+    double (*)(const Vector<double>&, const ShadingData<LommelSeeliger, SensorImage<uint16_t>>&),
+    Vector<double> (*)(const Vector<double>&, const ShadingData<LommelSeeliger, SensorImage<uint16_t>>&),
+    const ShadingData<LommelSeeliger, SensorImage<uint16_t>>&,
+    double,
+    const LineSearch<ShadingData<LommelSeeliger, SensorImage<uint16_t>>>*,
+    LBFGSControl*
+);
+
+template Vector<double> LBFGS<ShadingData<HapkeLite, SensorImage<uint16_t>>>(
+    Vector<double>&,
+    double (*)(const Vector<double>&, const ShadingData<HapkeLite, SensorImage<uint16_t>>&),
+    Vector<double> (*)(const Vector<double>&, const ShadingData<HapkeLite, SensorImage<uint16_t>>&),
+    const ShadingData<HapkeLite, SensorImage<uint16_t>>&,
+    double,
+    const LineSearch<ShadingData<HapkeLite, SensorImage<uint16_t>>>*,
+    LBFGSControl*
+);
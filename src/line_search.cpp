@@ -0,0 +1,201 @@
+// Line restrictions of the objectives, used by the L-BFGS line search.
+// Integrability, smoothness and the height objective are sums of squared
+// residuals that are linear in the unknowns, so along x + alpha d each
+// residual is r + alpha e and its square expands exactly.
+
+#include "../include/lbfgs.hpp"
+#include "../include/reflectance.hpp"
+#include "../include/matrix.hpp"
+#include "../include/vector.hpp"
+#include "../include/globals.hpp"
+#include "../include/perf_counters.hpp"
+
+// Add (r + alpha e)² to the coefficients
+static inline void accumulate(LineModel& line, double r, double e)
+{
+    line.constant += r * r;
+    line.linear += 2.0 * r * e;
+    line.quadratic += e * e;
+}
+
+template <typename Model, typename Image>
+LineModel shadingLinePrepare(
+    const Vector<double>& x,
+    const Vector<double>& d,
+    const ShadingData<Model, Image>& data
+)
+{
+    const EnergyWeights& weights = data.weights;
+    int rows = data.image->rows;
+    int cols = data.image->cols;
+    int n = rows * cols;
+    PerfScope perf("shading line prepare", n);
+
+    const double* p = x.values;
+    const double* q = x.values + n;
+    const double* dp = d.values;
+    const double* dq = d.values + n;
+
+    LineModel integrability = { 0.0, 0.0, 0.0 };
+    LineModel smoothness = { 0.0, 0.0, 0.0 };
+
+    for (int i = 0; i < rows - 1; i++)
+    {
+        for (int j = 0; j < cols - 1; j++)
+        {
+            int k = i * cols + j;
+            int down = k + cols;
+            int right = k + 1;
+
+            accumulate(integrability,
+                       p[right] - p[k] - q[down] + q[k],
+                       dp[right] - dp[k] - dq[down] + dq[k]);
+
+            accumulate(smoothness, p[down] - p[k], dp[down] - dp[k]);
+            accumulate(smoothness, p[right] - p[k], dp[right] - dp[k]);
+            accumulate(smoothness, q[right] - q[k], dq[right] - dq[k]);
+            accumulate(smoothness, q[down] - q[k], dq[down] - dq[k]);
+        }
+    }
+
+    LineModel line;
+    line.constant = weights.lambda_internal * integrability.constant + weights.lambda_csmo * smoothness.constant;
+    line.linear = weights.lambda_internal * integrability.linear + weights.lambda_csmo * smoothness.linear;
+    line.quadratic = weights.lambda_internal * integrability.quadratic + weights.lambda_csmo * smoothness.quadratic;
+
+    return line;
+}
+
+// Data term at x + alpha d and its derivative in alpha, in one pass
+template <typename Model, typename Image>
+double shadingLineRemainder(
+    const Vector<double>& x,
+    const Vector<double>& d,
+    double alpha,
+    const ShadingData<Model, Image>& data,
+    double& slope
+)
+{
+    const Image& image = *data.image;
+    const EnergyWeights& weights = data.weights;
+    int n = image.rows * image.cols;
+    PerfScope perf("shading line remainder", n);
+
+    const double* p = x.values;
+    const double* q = x.values + n;
+    const double* dp = d.values;
+    const double* dq = d.values + n;
+
+    double value = 0.0;
+    double R, R_p, R_q;
+    slope = 0.0;
+
+    for (int i = 0; i < image.rows; i++)
+    {
+        for (int j = 0; j < image.cols; j++)
+        {
+            int k = i * image.cols + j;
+
+            data.model.shade(p[k] + alpha * dp[k], q[k] + alpha * dq[k], R, R_p, R_q);
+
+            double r = greyLevel(image, i, j) - R;
+            value += r * r;
+            slope -= 2.0 * r * (R_p * dp[k] + R_q * dq[k]);
+        }
+    }
+
+    value *= weights.step_size * weights.step_size;
+    slope *= weights.step_size * weights.step_size;
+
+    return value;
+}
+
+LineModel objectiveLinePrepare(
+    const Vector<double>& x,
+    const Vector<double>& d,
+    const Matrix& image,
+    const EnergyWeights& weights
+)
+{
+    ShadingData<FrontalLambertian> data = { &image, FrontalLambertian(), weights };
+    return shadingLinePrepare(x, d, data);
+}
+
+double objectiveLineRemainder(
+    const Vector<double>& x,
+    const Vector<double>& d,
+    double alpha,
+    const Matrix& image,
+    const EnergyWeights& weights,
+    double& slope
+)
+{
+    ShadingData<FrontalLambertian> data = { &image, FrontalLambertian(), weights };
+    return shadingLineRemainder(x, d, alpha, data, slope);
+}
+
+// Height objective: entirely quadratic
+LineModel heightLinePrepare(
+    const Vector<double>& h,
+    const Vector<double>& d,
+    const HeightData& data
+)
+{
+    const Matrix& x = *data.derivatives;
+    const EnergyWeights& weights = data.weights;
+    int rows = x.rows / 2;
+    int cols = x.cols;
+    PerfScope perf("height line prepare", long(rows) * cols);
+
+    LineModel line = { 0.0, 0.0, 0.0 };
+
+    for (int i = 0; i < rows - 1; i++)
+    {
+        for (int j = 0; j < cols - 1; j++)
+        {
+            int k = i * cols + j;
+            int down = k + cols;
+            int right = k + 1;
+
+            accumulate(line,
+                       h.values[down] - h.values[k] - weights.step_size * x.values[i][j],
+                       d.values[down] - d.values[k]);
+
+            accumulate(line,
+                       h.values[right] - h.values[k] - weights.step_size * x.values[i + rows][j],
+                       d.values[right] - d.values[k]);
+        }
+    }
+
+    return line;
+}
+
+template LineModel shadingLinePrepare(const Vector<double>&, const Vector<double>&, const ShadingData<FrontalLambertian>&);
+template LineModel shadingLinePrepare(const Vector<double>&, const Vector<double>&, const ShadingData<Lambertian>&);
+template LineModel shadingLinePrepare(const Vector<double>&, const Vector<double>&, const ShadingData<LommelSeeliger>&);
+template LineModel shadingLinePrepare(const Vector<double>&, const Vector<double>&, const ShadingData<HapkeLite>&);
+
+template LineModel shadingLinePrepare(const Vector<double>&, const Vector<double>&, const ShadingData<FrontalLambertian, SensorImage<uint8_t>>&);
+template LineModel shadingLinePrepare(const Vector<double>&, const Vector<double>&, const ShadingData<Lambertian, SensorImage<uint8_t>>&);
+template LineModel shadingLinePrepare(const Vector<double>&, const Vector<double>&, const ShadingData<LommelSeeliger, SensorImage<uint8_t>>&);
+template LineModel shadingLinePrepare(const Vector<double>&, const Vector<double>&, const ShadingData<HapkeLite, SensorImage<uint8_t>>&);
+
+template LineModel shadingLinePrepare(const Vector<double>&, const Vector<double>&, const ShadingData<FrontalLambertian, SensorImage<uint16_t>>&);
+template LineModel shadingLinePrepare(const Vector<double>&, const Vector<double>&, const ShadingData<Lambertian, SensorImage<uint16_t>>&);
+template LineModel shadingLinePrepare(const Vector<double>&, const Vector<double>&, const ShadingData<LommelSeeliger, SensorImage<uint16_t>>&);
+template LineModel shadingLinePrepare(const Vector<double>&, const Vector<double>&, const ShadingData<HapkeLite, SensorImage<uint16_t>>&);
+
+template double shadingLineRemainder(const Vector<double>&, const Vector<double>&, double, const ShadingData<FrontalLambertian>&, double&);
+template double shadingLineRemainder(const Vector<double>&, const Vector<double>&, double, const ShadingData<Lambertian>&, double&);
+template double shadingLineRemainder(const Vector<double>&, const Vector<double>&, double, const ShadingData<LommelSeeliger>&, double&);
+template double shadingLineRemainder(const Vector<double>&, const Vector<double>&, double, const ShadingData<HapkeLite>&, double&);
+
+template double shadingLineRemainder(const Vector<double>&, const Vector<double>&, double, const ShadingData<FrontalLambertian, SensorImage<uint8_t>>&, double&);
+template double shadingLineRemainder(const Vector<double>&, const Vector<double>&, double, const ShadingData<Lambertian, SensorImage<uint8_t>>&, double&);
+template double shadingLineRemainder(const Vector<double>&, const Vector<double>&, double, const ShadingData<LommelSeeliger, SensorImage<uint8_t>>&, double&);
+template double shadingLineRemainder(const Vector<double>&, const Vector<double>&, double, const ShadingData<HapkeLite, SensorImage<uint8_t>>&, double&);
+
+template double shadingLineRemainder(const Vector<double>&, const Vector<double>&, double, const ShadingData<FrontalLambertian, SensorImage<uint16_t>>&, double&);
+template double shadingLineRemainder(const Vector<double>&, const Vector<double>&, double, const ShadingData<Lambertian, SensorImage<uint16_t>>&, double&);
+template double shadingLineRemainder(const Vector<double>&, const Vector<double>&, double, const ShadingData<LommelSeeliger, SensorImage<uint16_t>>&, double&);
+template double shadingLineRemainder(const Vector<double>&, const Vector<double>&, double, const ShadingData<HapkeLite, SensorImage<uint16_t>>&, double&);
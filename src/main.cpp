@@ -2,13 +2,798 @@
 #include "../include/vector.hpp"
 #include "../include/image_factory.hpp"
 #include "../include/lbfgs.hpp"
+#include "../include/active_domain.hpp"
+#include "../include/reflectance.hpp"
+#include "../include/distributed.hpp"
+#include "../include/pipeline.hpp"
+#include "../include/result_cache.hpp"
+#include "../include/daemon.hpp"
+#include "../include/height_tiles.hpp"
+#include "../include/perf_counters.hpp"
+#include "../include/continuation.hpp"
+#include "../include/autotune.hpp"
+#include "../include/globals.hpp"
 
+#include <chrono>
 #include <cmath>
+#include <cstdlib>
+#include <cstring>
 #include <ctime>
+#include <fstream>
 #include <iostream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
 
-int main()
+// First optimization for a given reflectance model and image type
+template <typename Model, typename Image>
+static Vector<double> solveShading(
+    Vector<double>& x0,
+    const Image& image,
+    const Model& model,
+    const EnergyWeights& weights,
+    double grad_tol,
+    LBFGSControl* control,
+    const ContinuationSchedule& schedule,
+    bool autodiff,
+    bool interleaved
+)
 {
+    ShadingData<Model, Image> data = { &image, model, weights };
+    LineSearch<ShadingData<Model, Image>> line = {
+        shadingLinePrepare<Model, Image>,
+        shadingLineRemainder<Model, Image>
+    };
+
+    if (interleaved)
+    {
+        // Solve on (p0, q0, p1, q1, ...), return p then q
+        LineSearch<ShadingData<Model, Image>> interleaved_line = {
+            interleavedShadingLinePrepare<Model, Image>,
+            interleavedShadingLineRemainder<Model, Image>
+        };
+
+        Vector<double> u0 = interleaveSlopes(x0);
+        Vector<double> u = continuationLBFGS(u0, interleavedShadingObjective<Model, Image>,
+                                             interleavedShadingGradient<Model, Image>,
+                                             data, grad_tol, &interleaved_line, control, schedule);
+        return splitSlopes(u);
+    }
+
+    if (autodiff)
+        return continuationLBFGS(x0, autodiffShadingObjective<Model, Image>, autodiffShadingGradient<Model, Image>,
+                                 data, grad_tol, &line, control, schedule);
+
+    return continuationLBFGS(x0, shadingObjective<Model, Image>, shadingGradient<Model, Image>,
+                             data, grad_tol, &line, control, schedule);
+}
+
+// Command line options of the reconstruction
+struct Options
+{
+    bool use_mask = false;
+    bool direct = false;                  // single-stage solve on the height field
+    bool autodiff = false;                // first stage: generated exact gradient
+    bool interleaved = false;             // first stage on (p, q) pairs instead of p then q
+    double background = 255.0;            // grey level of pixels left out of the solve
+
+    int sample_bits = 0;                  // 8 or 16: solve on integer samples (0: doubles)
+    double radiometric_scale = 0.0;       // grey level per sample unit (0: fit the range)
+
+    std::string model = "frontal";        // reflectance model
+    Vec3d light{{ 0.0, 0.0, 1.0 }};       // light direction
+
+    int num_workers = 0;                  // worker processes (0: solve in this process)
+    long worker_memory_mb = 0;            // address-space limit per worker (0: none)
+    bool pin_workers = true;              // one core per worker, bands grouped by NUMA node
+
+    EnergyWeights weights;                // integrability and smoothness weights, step
+    ContinuationSchedule continuation;    // weights stepped down from heavy smoothing
+
+    double grad_tol_1 = 100.0;              // stopping condition on objective gradient
+    double grad_tol_2 = std::pow(10.0, -3); // stopping condition on height gradient
+
+    double time_budget = 0.0;             // wall-clock seconds per image (0: none)
+    double min_decrease = 0.0;            // early exit on relative objective decrease (0: off)
+    int line_threads = 1;                 // line-search steps tried at once (and kernel threads)
+
+    double mesh_tolerance = -1.0;         // adaptive mesh tolerance (negative: one quad per pixel)
+
+    int lbfgs_memory = 5;                 // stored correction pairs
+    bool use_tuning = false;              // apply the settings calibrated by --autotune
+    bool tuning_explicit = false;         // memory, threads or layout given on the command line
+
+    std::shared_ptr<ResultCache> cache;   // previous reconstructions (null: no cache)
+};
+
+// First optimization on the full frame, dispatched on the reflectance model
+template <typename Image>
+static Vector<double> solveDerivatives(
+    Vector<double>& x0,
+    const Image& image,
+    const Options& options,
+    LBFGSControl* control
+)
+{
+    if (options.model == "lambert")
+        return solveShading(x0, image, Lambertian(options.light), options.weights,
+                            options.grad_tol_1, control, options.continuation,
+                            options.autodiff, options.interleaved);
+    else if (options.model == "lommel-seeliger")
+        return solveShading(x0, image, LommelSeeliger(options.light), options.weights,
+                            options.grad_tol_1, control, options.continuation,
+                            options.autodiff, options.interleaved);
+    else if (options.model == "hapke")
+        return solveShading(x0, image, HapkeLite(options.light), options.weights,
+                            options.grad_tol_1, control, options.continuation,
+                            options.autodiff, options.interleaved);
+    else
+        return solveShading(x0, image, FrontalLambertian(), options.weights,
+                            options.grad_tol_1, control, options.continuation,
+                            options.autodiff, options.interleaved);
+}
+
+// Stopping rules of one stage: the stage ends at start + share of the budget
+static LBFGSControl stageControl(
+    const Options& options,
+    LBFGSControl::Clock::time_point start,
+    double share
+)
+{
+    LBFGSControl control;
+    control.memory = options.lbfgs_memory;
+    control.min_decrease = options.min_decrease;
+    control.parallel_trials = options.line_threads;
+    control.kernel_threads = options.line_threads;
+
+    if (options.time_budget > 0.0)
+    {
+        control.has_deadline = true;
+        control.deadline = start + std::chrono::duration_cast<LBFGSControl::Clock::duration>(
+            std::chrono::duration<double>(share * options.time_budget));
+    }
+
+    return control;
+}
+
+// Quality report of one stage
+static void reportStage(const char* stage, const LBFGSControl& control)
+{
+    std::cout << stage << ": stopped on " << control.stop_reason << " after "
+              << control.iterations << " iterations, objective " << control.objective
+              << ", gradient norm " << control.gradient_norm << ", "
+              << control.seconds << " s\n";
+}
+
+// Solver settings that change the result, for the cache key
+static std::string settingsKey(const Options& options)
+{
+    std::ostringstream settings;
+    settings.precision(17);
+    settings << "model=" << options.model
+             << " light=" << options.light(1) << "," << options.light(2) << "," << options.light(3)
+             << " direct=" << options.direct << " autodiff=" << options.autodiff
+             << " interleaved=" << options.interleaved
+             << " bits=" << options.sample_bits << " scale=" << options.radiometric_scale
+             << " mask=" << options.use_mask << " background=" << options.background
+             << " workers=" << options.num_workers
+             << " tol=" << options.grad_tol_1 << "," << options.grad_tol_2
+             << " memory=" << options.lbfgs_memory
+             << " budget=" << options.time_budget << " decrease=" << options.min_decrease
+             << " continuation=" << options.continuation.stages << "," << options.continuation.factor;
+    return settings.str();
+}
+
+// 2D image → directional derivatives and height map. complete is false
+// when the time budget cut a stage short.
+static CachedResult solve(const Matrix& image, const Options& options, bool& complete)
+{
+    // Share of the time budget given to the first stage; the second stage
+    // runs until the end of the budget
+    const double first_stage_share = 0.75;
+
+    LBFGSControl::Clock::time_point start = LBFGSControl::Clock::now();
+    LBFGSControl first = stageControl(options, start, first_stage_share);
+    LBFGSControl second = stageControl(options, start, 1.0);
+
+    // Line restriction of the height objective: exact steps
+    LineSearch<HeightData> height_line = { heightLinePrepare, nullptr };
+
+    CachedResult result;
+
+    if (options.num_workers > 0)
+    {
+        // One band of rows per worker process (the derivatives stay in the workers)
+        result.height = distributedReconstruct(
+            image,
+            options.weights,
+            options.num_workers,
+            options.grad_tol_1,
+            options.grad_tol_2,
+            &first,
+            &second,
+            options.continuation,
+            options.worker_memory_mb,
+            options.pin_workers
+        );
+    }
+    else if (options.direct)
+    {
+        // Single optimization: height, with slopes from its finite differences
+        std::cout << "L-BFGS on direct height objective\n";
+
+        Vector<double> h;
+
+        if (options.model == "lambert")
+            h = directHeightReconstruct(image, Lambertian(options.light), options.weights,
+                                        options.grad_tol_1, &second);
+        else if (options.model == "lommel-seeliger")
+            h = directHeightReconstruct(image, LommelSeeliger(options.light), options.weights,
+                                        options.grad_tol_1, &second);
+        else if (options.model == "hapke")
+            h = directHeightReconstruct(image, HapkeLite(options.light), options.weights,
+                                        options.grad_tol_1, &second);
+        else
+            h = directHeightReconstruct(image, FrontalLambertian(), options.weights,
+                                        options.grad_tol_1, &second);
+
+        result.height = h.toMatrix(image.rows, image.cols);
+
+        reportStage("Direct height", second);
+        complete = second.stop_reason != std::string("deadline");
+        return result;
+    }
+    else if (options.use_mask)
+    {
+        // Solve only on the foreground pixels
+        ActiveDomain domain = buildActiveDomain(backgroundMask(image, options.background));
+        std::cout << "Active pixels: " << domain.num_active << " / "
+                  << image.rows * image.cols << "\n";
+
+        const LineSearch<MaskedData>* no_line = nullptr;   // plain Wolfe line search
+
+        MaskedData pixels;
+        pixels.domain = &domain;
+        pixels.values = gatherFromFrame(image, domain);
+        pixels.weights = options.weights;
+
+        std::cout << "L-BFGS on objective function\n";
+
+        Vector<double> x0(2 * domain.num_active, 0.5);
+        Vector<double> x = continuationLBFGS(
+            x0,
+            maskedObjective,
+            maskedGradient,
+            pixels,
+            options.grad_tol_1,
+            no_line,
+            &first,
+            options.continuation
+        );
+
+        std::cout << "L-BFGS on height\n";
+
+        MaskedData derivatives;
+        derivatives.domain = &domain;
+        derivatives.values = x;
+        derivatives.weights = options.weights;
+
+        Vector<double> h0(domain.num_active, 0.0);
+        Vector<double> h = LBFGS(
+            h0,
+            maskedHeightObjective,
+            maskedHeightGradient,
+            derivatives,
+            options.grad_tol_2,
+            no_line,
+            &second
+        );
+
+        result.height = scatterToFrame(h, domain, 0.0);
+
+        int na = domain.num_active;
+        Matrix p = scatterToFrame(x(0, na - 1), domain, 0.0);
+        Matrix q = scatterToFrame(x(na, 2 * na - 1), domain, 0.0);
+
+        result.derivatives = Matrix(2 * image.rows, image.cols);
+        for (int i = 0; i < image.rows; i++)
+        {
+            for (int j = 0; j < image.cols; j++)
+            {
+                result.derivatives.values[i][j] = p.values[i][j];
+                result.derivatives.values[image.rows + i][j] = q.values[i][j];
+            }
+        }
+    }
+    else
+    {
+        // First optimization: recover directional derivatives of height
+        std::cout << "L-BFGS on objective function\n";
+
+        Vector<double> x0(2 * image.rows * image.cols, 0.5);
+        Vector<double> x;
+
+        if (options.sample_bits == 8)
+            x = solveDerivatives(x0, quantizeImage<uint8_t>(image, options.radiometric_scale), options, &first);
+        else if (options.sample_bits == 16)
+            x = solveDerivatives(x0, quantizeImage<uint16_t>(image, options.radiometric_scale), options, &first);
+        else
+            x = solveDerivatives(x0, image, options, &first);
+
+        result.derivatives = x.toMatrix(2 * image.rows, image.cols);
+
+        // Second optimization: compute height at each pixel
+        std::cout << "L-BFGS on height\n";
+
+        HeightData height_data = { &result.derivatives, options.weights };
+
+        Vector<double> h0(image.rows * image.cols, 0.0);
+        Vector<double> y = LBFGS(
+            h0,
+            heightObjective,
+            heightGradient,
+            height_data,
+            options.grad_tol_2,
+            &height_line,
+            &second
+        );
+
+        result.height = y.toMatrix(image.rows, image.cols);
+    }
+
+    reportStage("Stage 1 (derivatives)", first);
+    reportStage("Stage 2 (height)", second);
+
+    complete = first.stop_reason != std::string("deadline") &&
+               second.stop_reason != std::string("deadline");
+
+    return result;
+}
+
+// Options with the settings calibrated on this host for the size of
+// image, unless given on the command line or not used by the solve
+static Options tunedOptions(const Options& options, const Matrix& image)
+{
+    Options tuned = options;
+    TunedSettings settings;
+
+    if (!options.use_tuning || options.tuning_explicit || options.direct || options.use_mask ||
+        options.num_workers > 0 || options.autodiff)
+        return tuned;
+
+    if (!loadTuning(sizeClass(image.rows, image.cols), settings))
+    {
+        std::cout << "Tuned settings: none recorded for this host and image size\n";
+        return tuned;
+    }
+
+    tuned.lbfgs_memory = settings.lbfgs_memory;
+    tuned.line_threads = settings.line_threads;
+    tuned.interleaved = settings.interleaved;
+
+    std::cout << "Tuned settings: memory " << tuned.lbfgs_memory << ", line threads "
+              << tuned.line_threads << ", interleaved " << tuned.interleaved << "\n";
+
+    return tuned;
+}
+
+// 2D image → derivatives and height map, served from the cache when possible
+static CachedResult reconstructResult(const Matrix& image, const Options& requested)
+{
+    bool complete = true;
+    Options options = tunedOptions(requested, image);
+
+    if (!options.cache)
+        return solve(image, options, complete);
+
+    std::string key = options.cache->key(image, options.weights, settingsKey(options));
+
+    CachedResult result;
+    if (options.cache->load(key, result))
+    {
+        std::cout << "Cache hit: " << key << "\n";
+        return result;
+    }
+
+    // A run cut short by the time budget depends on the machine load
+    result = solve(image, options, complete);
+    if (complete)
+        options.cache->store(key, result);
+
+    return result;
+}
+
+// 2D image → height map
+static Matrix reconstruct(const Matrix& image, const Options& options)
+{
+    return std::move(reconstructResult(image, options).height);
+}
+
+// Library parameters of a job handed to the daemon
+static sfs_params daemonParameters(const Options& options)
+{
+    sfs_params params;
+    sfs_default_params(&params);
+
+    params.lambda_internal = options.weights.lambda_internal;
+    params.lambda_csmo = options.weights.lambda_csmo;
+    params.continuation_stages = options.continuation.stages;
+    params.continuation_factor = options.continuation.factor;
+    params.grad_tol_1 = options.grad_tol_1;
+    params.grad_tol_2 = options.grad_tol_2;
+    params.direct = options.direct;
+    params.time_budget = options.time_budget;
+    params.line_threads = options.line_threads;
+    params.lbfgs_memory = options.lbfgs_memory;
+
+    if (options.model == "lambert")
+        params.model = SFS_MODEL_LAMBERT;
+    else if (options.model == "lommel-seeliger")
+        params.model = SFS_MODEL_LOMMEL_SEELIGER;
+    else if (options.model == "hapke")
+        params.model = SFS_MODEL_HAPKE;
+    else
+        params.model = SFS_MODEL_FRONTAL;
+
+    for (int c = 0; c < 3; c++)
+        params.light[c] = options.light(c + 1);
+
+    return params;
+}
+
+int main(int argc, char** argv)
+{
+    Options options;
+
+    std::string batch_file;               // list of "<input.csv> <output.mesh>" jobs
+    int queue_depth = 0;                  // images in flight between pipeline stages,
+                                          // jobs waiting in the daemon (0: default)
+
+    std::string serve_socket;             // run as a daemon on this socket
+    int serve_workers = 2;                // concurrent solves of the daemon
+    std::string submit_socket;            // hand the job to a daemon instead
+    std::string submit_input, submit_output;
+
+    int autotune_side = 0;                // calibrate on a synthetic side x side image
+
+    std::string tiles_file;               // tiled height map written next to the mesh
+    int tile_size = 256;
+
+    std::string region_file;              // edited image whose region is re-solved
+    int region[4] = { 0, 0, 0, 0 };      // row_min, col_min, row_max, col_max (1-based)
+    int region_halo = 8;                  // pixels re-solved around the region
+
+    std::string cache_dir;                // result cache directory (empty: no cache)
+    long cache_size_mb = 1024;            // size bound of the cache
+
+    for (int a = 1; a < argc; a++)
+    {
+        if (!std::strcmp(argv[a], "--background") && a + 1 < argc)
+        {
+            options.use_mask = true;
+            options.background = std::atof(argv[++a]);
+        }
+        else if (!std::strcmp(argv[a], "--light") && a + 3 < argc)
+        {
+            options.light(1) = std::atof(argv[++a]);
+            options.light(2) = std::atof(argv[++a]);
+            options.light(3) = std::atof(argv[++a]);
+            if (options.model == "frontal")
+                options.model = "lambert";
+        }
+        else if (!std::strcmp(argv[a], "--direct"))
+        {
+            options.direct = true;
+        }
+        else if (!std::strcmp(argv[a], "--autodiff"))
+        {
+            options.autodiff = true;
+        }
+        else if (!std::strcmp(argv[a], "--interleaved"))
+        {
+            options.interleaved = true;
+            options.tuning_explicit = true;
+        }
+        else if (!std::strcmp(argv[a], "--sample-bits") && a + 1 < argc)
+        {
+            options.sample_bits = std::atoi(argv[++a]);
+        }
+        else if (!std::strcmp(argv[a], "--radiometric-scale") && a + 1 < argc)
+        {
+            options.radiometric_scale = std::atof(argv[++a]);
+        }
+        else if (!std::strcmp(argv[a], "--lambda-internal") && a + 1 < argc)
+        {
+            options.weights.lambda_internal = std::atof(argv[++a]);
+        }
+        else if (!std::strcmp(argv[a], "--lambda-csmo") && a + 1 < argc)
+        {
+            options.weights.lambda_csmo = std::atof(argv[++a]);
+        }
+        else if (!std::strcmp(argv[a], "--continuation") && a + 1 < argc)
+        {
+            options.continuation.stages = std::atoi(argv[++a]);
+        }
+        else if (!std::strcmp(argv[a], "--continuation-factor") && a + 1 < argc)
+        {
+            options.continuation.factor = std::atof(argv[++a]);
+        }
+        else if (!std::strcmp(argv[a], "--time-budget") && a + 1 < argc)
+        {
+            options.time_budget = std::atof(argv[++a]);
+        }
+        else if (!std::strcmp(argv[a], "--min-decrease") && a + 1 < argc)
+        {
+            options.min_decrease = std::atof(argv[++a]);
+        }
+        else if (!std::strcmp(argv[a], "--line-threads") && a + 1 < argc)
+        {
+            options.line_threads = std::atoi(argv[++a]);
+            options.tuning_explicit = true;
+        }
+        else if (!std::strcmp(argv[a], "--lbfgs-memory") && a + 1 < argc)
+        {
+            options.lbfgs_memory = std::atoi(argv[++a]);
+            options.tuning_explicit = true;
+        }
+        else if (!std::strcmp(argv[a], "--autotune") && a + 1 < argc)
+        {
+            autotune_side = std::atoi(argv[++a]);
+        }
+        else if (!std::strcmp(argv[a], "--tuned"))
+        {
+            options.use_tuning = true;
+        }
+        else if (!std::strcmp(argv[a], "--mesh-tolerance") && a + 1 < argc)
+        {
+            options.mesh_tolerance = std::atof(argv[++a]);
+        }
+        else if (!std::strcmp(argv[a], "--model") && a + 1 < argc)
+        {
+            options.model = argv[++a];
+        }
+        else if (!std::strcmp(argv[a], "--workers") && a + 1 < argc)
+        {
+            options.num_workers = std::atoi(argv[++a]);
+        }
+        else if (!std::strcmp(argv[a], "--worker-memory") && a + 1 < argc)
+        {
+            options.worker_memory_mb = std::atol(argv[++a]);
+        }
+        else if (!std::strcmp(argv[a], "--no-pin"))
+        {
+            options.pin_workers = false;
+        }
+        else if (!std::strcmp(argv[a], "--batch") && a + 1 < argc)
+        {
+            batch_file = argv[++a];
+        }
+        else if (!std::strcmp(argv[a], "--queue-depth") && a + 1 < argc)
+        {
+            queue_depth = std::atoi(argv[++a]);
+        }
+        else if (!std::strcmp(argv[a], "--serve") && a + 1 < argc)
+        {
+            serve_socket = argv[++a];
+        }
+        else if (!std::strcmp(argv[a], "--serve-workers") && a + 1 < argc)
+        {
+            serve_workers = std::atoi(argv[++a]);
+        }
+        else if (!std::strcmp(argv[a], "--submit") && a + 3 < argc)
+        {
+            submit_socket = argv[++a];
+            submit_input = argv[++a];
+            submit_output = argv[++a];
+        }
+        else if (!std::strcmp(argv[a], "--tiles") && a + 1 < argc)
+        {
+            tiles_file = argv[++a];
+        }
+        else if (!std::strcmp(argv[a], "--tile-size") && a + 1 < argc)
+        {
+            tile_size = std::atoi(argv[++a]);
+        }
+        else if (!std::strcmp(argv[a], "--perf"))
+        {
+            setPerfEnabled(true);
+        }
+        else if (!std::strcmp(argv[a], "--region") && a + 5 < argc)
+        {
+            region_file = argv[++a];
+            for (int c = 0; c < 4; c++)
+                region[c] = std::atoi(argv[++a]);
+        }
+        else if (!std::strcmp(argv[a], "--region-halo") && a + 1 < argc)
+        {
+            region_halo = std::atoi(argv[++a]);
+        }
+        else if (!std::strcmp(argv[a], "--cache") && a + 1 < argc)
+        {
+            cache_dir = argv[++a];
+        }
+        else if (!std::strcmp(argv[a], "--cache-size") && a + 1 < argc)
+        {
+            cache_size_mb = std::atol(argv[++a]);
+        }
+        else
+        {
+            std::cerr << "Usage: " << argv[0] << " [--background <grey level>]"
+                      << " [--light <lx> <ly> <lz>]"
+                      << " [--model lambert|lommel-seeliger|hapke] [--direct] [--autodiff] [--interleaved]"
+                      << " [--sample-bits 8|16 [--radiometric-scale <grey per unit>]]"
+                      << " [--lambda-internal <w>] [--lambda-csmo <w>]"
+                      << " [--continuation <stages> [--continuation-factor <f>]]"
+                      << " [--time-budget <seconds>] [--min-decrease <fraction>]"
+                      << " [--line-threads <n>] [--lbfgs-memory <n>] [--mesh-tolerance <height>]"
+                      << " [--autotune <side>] [--tuned]"
+                      << " [--workers <n> [--worker-memory <MB>] [--no-pin]]"
+                      << " [--batch <job list> [--queue-depth <n>]]"
+                      << " [--cache <directory> [--cache-size <MB>]]"
+                      << " [--tiles <file> [--tile-size <n>]] [--perf]"
+                      << " [--region <edited.csv> <row min> <col min> <row max> <col max> [--region-halo <n>]]"
+                      << " [--serve <socket> [--serve-workers <n>] [--queue-depth <n>]]"
+                      << " [--submit <socket> <input.csv> <output.mesh>]\n";
+            return 1;
+        }
+    }
+
+    if (options.model != "frontal" && options.model != "lambert" &&
+        options.model != "lommel-seeliger" && options.model != "hapke")
+    {
+        std::cerr << "Unknown reflectance model: " << options.model << "\n";
+        return 1;
+    }
+
+    if (options.use_mask && options.model != "frontal")
+    {
+        std::cerr << "The masked solve supports frontal Lambertian shading only.\n";
+        return 1;
+    }
+
+    if (options.sample_bits != 0 && options.sample_bits != 8 && options.sample_bits != 16)
+    {
+        std::cerr << "Integer samples are 8 or 16 bits wide.\n";
+        return 1;
+    }
+
+    if (options.sample_bits != 0 && (options.direct || options.use_mask || options.num_workers > 0))
+    {
+        std::cerr << "Integer samples are supported by the full-frame two-stage solve only.\n";
+        return 1;
+    }
+
+    if (options.lbfgs_memory < 1 || options.line_threads < 1)
+    {
+        std::cerr << "The L-BFGS memory and the line-search threads are at least 1.\n";
+        return 1;
+    }
+
+    if (options.weights.lambda_internal < 0.0 || options.weights.lambda_csmo < 0.0 ||
+        options.continuation.stages < 1 || options.continuation.factor < 1.0)
+    {
+        std::cerr << "Weights are non-negative; continuation takes at least one stage and a factor of at least 1.\n";
+        return 1;
+    }
+
+    if (options.interleaved && (options.autodiff || options.direct || options.use_mask || options.num_workers > 0))
+    {
+        std::cerr << "The interleaved layout covers the hand-written full-frame first stage in this process.\n";
+        return 1;
+    }
+
+    if (options.autodiff && (options.direct || options.use_mask || options.num_workers > 0))
+    {
+        std::cerr << "The generated gradient covers the full-frame two-stage solve in this process.\n";
+        return 1;
+    }
+
+    if (options.continuation.stages > 1 && options.direct)
+    {
+        std::cerr << "Continuation applies to the first stage of the two-stage solve.\n";
+        return 1;
+    }
+
+    if (options.direct && (options.use_mask || options.num_workers > 0))
+    {
+        std::cerr << "The direct height solve runs on the full frame in this process only.\n";
+        return 1;
+    }
+
+    if (options.num_workers > 0 && (options.use_mask || options.model != "frontal"))
+    {
+        std::cerr << "The multi-process solve supports the full-frame frontal Lambertian energy only.\n";
+        return 1;
+    }
+
+    if (!submit_socket.empty() &&
+        (options.use_mask || options.sample_bits != 0 || options.num_workers > 0))
+    {
+        std::cerr << "Daemon jobs are full-frame solves on double grey levels.\n";
+        return 1;
+    }
+
+    if (!batch_file.empty() && options.num_workers > 0)
+    {
+        // The workers are forked from the solver thread, and a fork while
+        // the loader and writer threads run leaves the children unsafe
+        std::cerr << "The multi-process solve is not available in a batch.\n";
+        return 1;
+    }
+
+    if (!tiles_file.empty() && !batch_file.empty())
+    {
+        std::cerr << "Tiled height maps are written for a single image only.\n";
+        return 1;
+    }
+
+    if (!region_file.empty() &&
+        (!batch_file.empty() || options.direct || options.use_mask || options.sample_bits != 0 ||
+         options.num_workers > 0 || options.model != "frontal" || region_halo < 0))
+    {
+        std::cerr << "A region is re-solved on the full-frame frontal Lambertian two-stage solve"
+                  << " of a single image, with a non-negative halo.\n";
+        return 1;
+    }
+
+    // Calibration: time first-stage solves of a synthetic image and record
+    // the fastest settings for this host and size class
+    if (autotune_side > 0)
+    {
+        if (autotune_side < 8)
+        {
+            std::cerr << "Calibrate on images of at least 8 x 8 pixels.\n";
+            return 1;
+        }
+
+        Matrix image = syntheticImage(autotune_side, autotune_side);
+
+        TunedSettings best = autotune(image, [&options](const TunedSettings& settings, const Matrix& image)
+        {
+            Options trial;
+            trial.model = options.model;
+            trial.light = options.light;
+            trial.weights = options.weights;
+            trial.grad_tol_1 = options.grad_tol_1;
+            trial.lbfgs_memory = settings.lbfgs_memory;
+            trial.line_threads = settings.line_threads;
+            trial.interleaved = settings.interleaved;
+
+            // A candidate much slower than the default is not worth finishing
+            const double calibration_limit = 120.0;
+            trial.time_budget = calibration_limit;
+
+            LBFGSControl control = stageControl(trial, LBFGSControl::Clock::now(), 1.0);
+            control.verbose = false;
+
+            Vector<double> x0(2 * image.rows * image.cols, 0.5);
+            solveDerivatives(x0, image, trial, &control);
+
+            if (std::string(control.stop_reason) != "gradient")
+                return HUGE_VAL;
+            return control.seconds;
+        });
+
+        saveTuning(sizeClass(image.rows, image.cols), best);
+        return 0;
+    }
+
+    // Daemon: jobs carry their own parameters
+    if (!serve_socket.empty())
+        return runDaemon(serve_socket, serve_workers, queue_depth > 0 ? queue_depth : 16);
+
+    if (!submit_socket.empty())
+    {
+        int status = submitJob(submit_socket, submit_input, submit_output, daemonParameters(options),
+                               options.mesh_tolerance);
+        return (status == SFS_OK || status == SFS_INCOMPLETE) ? 0 : 1;
+    }
+
+    if (!cache_dir.empty())
+        options.cache.reset(new ResultCache(cache_dir, cache_size_mb << 20));
+
     /*
     // Mesh → 2D image
     ImageFactory mesh("maillages/dragon.mesh");
@@ -22,50 +807,107 @@ int main()
     mesh.save2D("images/dragon2.ppm");
     */
 
-    // 2D image → mesh reconstruction
-
-    Matrix image = csvToMatrix("images/dragon.csv");
     const clock_t begin_time = clock(); // start timer
+    int status = 0;
 
-    // First optimization: recover directional derivatives of height
-    std::cout << "L-BFGS on objective function\n";
+    if (!batch_file.empty())
+    {
+        // Batch: load, solve and export overlap in a pipeline
+        std::ifstream list(batch_file);
+        if (!list)
+        {
+            std::cerr << "Unable to open job list: " << batch_file << "\n";
+            return 1;
+        }
 
-    Vector<double> x0(2 * image.rows * image.cols, 0.5);
-    double grad_tol_1 = 100.0; // stopping condition on objective gradient
+        std::vector<PipelineJob> jobs;
+        PipelineJob job;
+        while (list >> job.input >> job.output)
+            jobs.push_back(job);
 
-    Vector<double> x = LBFGS(
-        x0,
-        objectiveFunction,
-        computeGradient,
-        image,
-        grad_tol_1
-    );
+        int failed = runPipeline(
+            jobs,
+            [&options](const Matrix& image) { return reconstruct(image, options); },
+            queue_depth > 0 ? queue_depth : 2,
+            options.mesh_tolerance
+        );
 
-    Matrix height_derivatives = x.toMatrix(2 * image.rows, image.cols);
+        if (failed > 0)
+            status = 1;
+    }
+    else
+    {
+        // 2D image → mesh reconstruction
+        Matrix image;
+        {
+            PerfScope perf("load", 0);
+            image = csvToMatrix("images/dragon.csv");
+            perf.setPixels(long(image.rows) * image.cols);
+        }
 
-    // Second optimization: compute height at each pixel
-    std::cout << "L-BFGS on height\n";
+        long pixels = long(image.rows) * image.cols;
+        Matrix reconstructed;
+        if (region_file.empty())
+        {
+            PerfScope perf("solve", pixels, true);
+            reconstructed = reconstruct(image, options);
+        }
+        else
+        {
+            // Solution of the original image (from the cache when possible),
+            // then a re-solve of the region of the edited image around it
+            CachedResult base;
+            {
+                PerfScope perf("solve", pixels, true);
+                base = reconstructResult(image, options);
+            }
 
-    Vector<double> h0(image.rows * image.cols, 0.0);
-    double grad_tol_2 = std::pow(10.0, -3); // stopping condition on height gradient
+            Matrix edited = csvToMatrix(region_file.c_str());
+            Vector<double> x = toVector(base.derivatives);
+            std::string error;
+
+            PerfScope perf("region", pixels, true);
+            std::cout << "Re-solving rows " << region[0] << "-" << region[2]
+                      << ", columns " << region[1] << "-" << region[3] << "\n";
 
-    Vector<double> y = LBFGS(
-        h0,
-        heightObjective,
-        heightGradient,
-        height_derivatives,
-        grad_tol_2
-    );
+            if (!resolveRegion(x, base.height, edited, options.weights,
+                               region[0], region[1], region[2], region[3], region_halo,
+                               options.grad_tol_1, options.grad_tol_2, error))
+            {
+                std::cerr << "Error: " << error << ".\n";
+                return 1;
+            }
 
-    Matrix reconstructed = y.toMatrix(image.rows, image.cols);
+            reconstructed = std::move(base.height);
+        }
 
-    // Save reconstructed mesh
-    matrixToMesh("maillages/dragon.mesh", reconstructed);
+        // Save reconstructed mesh
+        {
+            PerfScope perf("export", pixels);
+            matrixToMesh("maillages/dragon.mesh", reconstructed, options.mesh_tolerance);
+        }
+
+        if (!tiles_file.empty())
+        {
+            try
+            {
+                writeHeightTiles(tiles_file, reconstructed, tile_size);
+            }
+            catch (const std::runtime_error& e)
+            {
+                std::cerr << "Error: " << e.what() << ".\n";
+                return 1;
+            }
+        }
+    }
 
     // Print execution time
     std::cout << "Execution time (seconds): "
               << float(clock() - begin_time) / CLOCKS_PER_SEC
               << "\n";
 
-    return 0;
+    if (perfEnabled())
+        printPerfReport(std::cout);
+
+    return status;
 }
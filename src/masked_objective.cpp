@@ -0,0 +1,79 @@
+#include "../include/active_domain.hpp"
+#include "../include/vector.hpp"
+#include "../include/globals.hpp"
+#include "../include/perf_counters.hpp"
+#include <cmath>
+
+// Objective function restricted to the active pixels: difference terms are
+// kept only when both pixels of the stencil are inside the mask
+double maskedObjective(const Vector<double>& x, const MaskedData& data)
+{
+    const ActiveDomain& domain = *data.domain;
+    const EnergyWeights& weights = data.weights;
+    int n = domain.num_active;
+    PerfScope perf("masked objective", n);
+
+    const double* p = x.values;
+    const double* q = x.values + n;
+    const double* image = data.values.values;
+
+    double data_term = 0.0;
+    double integrability_term = 0.0;
+    double smoothness_term = 0.0;
+
+    for (int k = 0; k < n; k++)
+    {
+        int down = domain.down.values[k];
+        int right = domain.right.values[k];
+
+        data_term += std::pow(
+            image[k] - 255.0 / std::sqrt(1 + p[k] * p[k] + q[k] * q[k]),
+            2
+        );
+
+        if (down >= 0 && right >= 0)
+            integrability_term += std::pow(p[right] - p[k] - q[down] + q[k], 2);
+
+        if (down >= 0)
+            smoothness_term +=
+                std::pow(p[down] - p[k], 2) + std::pow(q[down] - q[k], 2);
+
+        if (right >= 0)
+            smoothness_term +=
+                std::pow(p[right] - p[k], 2) + std::pow(q[right] - q[k], 2);
+    }
+
+    data_term *= weights.step_size * weights.step_size;
+    integrability_term *= weights.lambda_internal;
+    smoothness_term *= weights.lambda_csmo;
+
+    return data_term + integrability_term + smoothness_term;
+}
+
+// Height objective restricted to the active pixels
+double maskedHeightObjective(const Vector<double>& h, const MaskedData& data)
+{
+    const ActiveDomain& domain = *data.domain;
+    const EnergyWeights& weights = data.weights;
+    int n = domain.num_active;
+    PerfScope perf("masked height objective", n);
+
+    const double* p = data.values.values;
+    const double* q = data.values.values + n;
+
+    double value = 0.0;
+
+    for (int k = 0; k < n; k++)
+    {
+        int down = domain.down.values[k];
+        int right = domain.right.values[k];
+
+        if (down >= 0)
+            value += std::pow(h.values[down] - h.values[k] - weights.step_size * p[k], 2);
+
+        if (right >= 0)
+            value += std::pow(h.values[right] - h.values[k] - weights.step_size * q[k], 2);
+    }
+
+    return value;
+}
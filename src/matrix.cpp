@@ -1,5 +1,6 @@
 #include "../include/matrix.hpp"
 #include "../include/vector.hpp"
+#include "../include/arena.hpp"
 
 #include <cstdlib>
 #include <iostream>
@@ -8,54 +9,94 @@
 
 // ====================== Matrix class ======================
 
+// Storage: one row-pointer table and one contiguous block of values
+void Matrix::allocate(int r, int c)
+{
+    rows = r;
+    cols = c;
+
+    if (rows <= 0)
+    {
+        values = nullptr;
+        pooled = false;
+        return;
+    }
+
+    FrameArena* arena = activeArena();
+    pooled = arena != nullptr;
+
+    double* block;
+    if (pooled)
+    {
+        values = static_cast<double**>(arena->allocate(rows * sizeof(double*)));
+        block = static_cast<double*>(arena->allocate(size_t(rows) * cols * sizeof(double)));
+    }
+    else
+    {
+        values = new double*[rows];
+        block = new double[size_t(rows) * cols];
+    }
+
+    for (int i = 0; i < rows; i++)
+        values[i] = block + size_t(i) * cols;
+}
+
+void Matrix::release()
+{
+    if (values && !pooled)
+    {
+        delete[] values[0];
+        delete[] values;
+    }
+    values = nullptr;
+}
+
 // Constructors
 Matrix::Matrix()
 {
     rows = 0;
     cols = 0;
     values = nullptr;
+    pooled = false;
 }
 
 Matrix::Matrix(int r, int c)
 {
-    rows = r;
-    cols = c;
-    values = new double*[rows];
+    allocate(r, c);
 
     for (int i = 0; i < rows; i++)
-    {
-        values[i] = new double[cols];
         for (int j = 0; j < cols; j++)
             values[i][j] = 0.0;
-    }
 }
 
 Matrix::Matrix(int r, int c, double value)
 {
-    rows = r;
-    cols = c;
-    values = new double*[rows];
+    allocate(r, c);
 
     for (int i = 0; i < rows; i++)
-    {
-        values[i] = new double[cols];
         for (int j = 0; j < cols; j++)
             values[i][j] = value;
-    }
 }
 
 Matrix::Matrix(const Matrix& M)
 {
-    rows = M.rows;
-    cols = M.cols;
+    allocate(M.rows, M.cols);
 
-    values = new double*[rows];
     for (int i = 0; i < rows; i++)
-    {
-        values[i] = new double[cols];
         for (int j = 0; j < cols; j++)
             values[i][j] = M.values[i][j];
-    }
+}
+
+Matrix::Matrix(Matrix&& M) noexcept
+{
+    rows = M.rows;
+    cols = M.cols;
+    values = M.values;
+    pooled = M.pooled;
+
+    M.rows = M.cols = 0;
+    M.values = nullptr;
+    M.pooled = false;
 }
 
 // Identity matrix constructor
@@ -67,30 +108,21 @@ Matrix::Matrix(int dim, const std::string& id)
         std::exit(1);
     }
 
-    rows = cols = dim;
-    values = new double*[dim];
+    allocate(dim, dim);
 
     for (int i = 0; i < dim; i++)
-    {
-        values[i] = new double[dim];
         for (int j = 0; j < dim; j++)
             values[i][j] = (i == j) ? 1.0 : 0.0;
-    }
 }
 
 // Destructor
 Matrix::~Matrix()
 {
-    if (values)
-    {
-        for (int i = 0; i < rows; i++)
-            delete[] values[i];
-        delete[] values;
-    }
+    release();
     rows = cols = 0;
 }
 
-// Assignment
+// Assignment (storage is reused when the sizes match)
 Matrix& Matrix::operator=(const Matrix& M)
 {
     if (this == &M)
@@ -98,21 +130,32 @@ Matrix& Matrix::operator=(const Matrix& M)
 
     if (rows != M.rows || cols != M.cols)
     {
-        for (int i = 0; i < rows; i++)
-            delete[] values[i];
-        delete[] values;
-
-        rows = M.rows;
-        cols = M.cols;
-        values = new double*[rows];
+        release();
+        allocate(M.rows, M.cols);
     }
 
     for (int i = 0; i < rows; i++)
-    {
-        values[i] = new double[cols];
         for (int j = 0; j < cols; j++)
             values[i][j] = M.values[i][j];
-    }
+
+    return *this;
+}
+
+Matrix& Matrix::operator=(Matrix&& M) noexcept
+{
+    if (this == &M)
+        return *this;
+
+    release();
+
+    rows = M.rows;
+    cols = M.cols;
+    values = M.values;
+    pooled = M.pooled;
+
+    M.rows = M.cols = 0;
+    M.values = nullptr;
+    M.pooled = false;
 
     return *this;
 }
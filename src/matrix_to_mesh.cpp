@@ -1,20 +1,38 @@
 #include "../include/matrix.hpp"
+#include "../include/lbfgs.hpp"
 
+#include <algorithm>
+#include <cmath>
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <vector>
 
 // Save height matrix to mesh file
-void matrixToMesh(const std::string& filename, const Matrix& M)
+void matrixToMesh(const std::string& filename, const Matrix& M, double tolerance)
 {
     std::ofstream mesh(filename);
 
+    if (tolerance < 0.0)
+        writeMesh(mesh, M);
+    else
+        writeAdaptiveMesh(mesh, M, tolerance);
+}
+
+static void writeHeader(std::ostream& mesh)
+{
     mesh << "\n";
     mesh << "MeshVersionFormatted\n";
     mesh << "1\n\n";
 
     mesh << "Dimension\n";
     mesh << "3\n\n";
+}
+
+// Write height matrix as mesh text
+void writeMesh(std::ostream& mesh, const Matrix& M)
+{
+    writeHeader(mesh);
 
     mesh << "Vertices\n";
     mesh << M.rows * M.cols << "\n";
@@ -43,3 +61,183 @@ void matrixToMesh(const std::string& filename, const Matrix& M)
         }
     }
 }
+
+// Square cell of the quadtree: pixels [i, i + size] x [j, j + size]
+struct MeshCell
+{
+    int i, j, size;
+};
+
+// Largest distance between the heights of a cell and the bilinear
+// interpolation of its corners
+static double cellDeviation(const Matrix& M, const MeshCell& cell)
+{
+    double h00 = M.values[cell.i][cell.j];
+    double h10 = M.values[cell.i + cell.size][cell.j];
+    double h01 = M.values[cell.i][cell.j + cell.size];
+    double h11 = M.values[cell.i + cell.size][cell.j + cell.size];
+
+    double deviation = 0.0;
+
+    for (int a = 0; a <= cell.size; a++)
+    {
+        double u = double(a) / cell.size;
+        double left = h00 + u * (h10 - h00);
+        double right = h01 + u * (h11 - h01);
+
+        for (int b = 0; b <= cell.size; b++)
+        {
+            double v = double(b) / cell.size;
+            double interpolated = left + v * (right - left);
+            deviation = std::max(deviation, std::abs(M.values[cell.i + a][cell.j + b] - interpolated));
+        }
+    }
+
+    return deviation;
+}
+
+// Split cells until each lies in the frame and follows its bilinear
+// interpolation within tolerance; the leaves are appended to leaves
+static void buildQuadtree(const Matrix& M, const MeshCell& cell, double tolerance,
+                          std::vector<MeshCell>& leaves)
+{
+    if (cell.i >= M.rows - 1 || cell.j >= M.cols - 1)
+        return;
+
+    bool inside = cell.i + cell.size <= M.rows - 1 && cell.j + cell.size <= M.cols - 1;
+
+    if (inside && (cell.size == 1 || cellDeviation(M, cell) <= tolerance))
+    {
+        leaves.push_back(cell);
+        return;
+    }
+
+    int half = cell.size / 2;
+    buildQuadtree(M, { cell.i, cell.j, half }, tolerance, leaves);
+    buildQuadtree(M, { cell.i + half, cell.j, half }, tolerance, leaves);
+    buildQuadtree(M, { cell.i, cell.j + half, half }, tolerance, leaves);
+    buildQuadtree(M, { cell.i + half, cell.j + half, half }, tolerance, leaves);
+}
+
+// Write height matrix as mesh text, merging pixel cells with a quadtree.
+// A leaf whose sides carry corners of smaller neighbours (T-junctions) is
+// split into a fan of triangles around its centre, so the mesh has no
+// cracks; other leaves stay quadrilaterals.
+void writeAdaptiveMesh(std::ostream& mesh, const Matrix& M, double tolerance)
+{
+    int side = 1;
+    while (side < std::max(M.rows - 1, M.cols - 1))
+        side *= 2;
+
+    std::vector<MeshCell> leaves;
+    if (M.rows > 1 && M.cols > 1)
+        buildQuadtree(M, { 0, 0, side }, tolerance, leaves);
+
+    // Pixels kept as vertices: the corners of every leaf, and the centres
+    // of the leaves with T-junctions
+    std::vector<char> kept(size_t(M.rows) * M.cols, 0);
+    auto at = [&M](int i, int j) { return size_t(j) * M.rows + i; };
+
+    for (const MeshCell& cell : leaves)
+    {
+        kept[at(cell.i, cell.j)] = 1;
+        kept[at(cell.i + cell.size, cell.j)] = 1;
+        kept[at(cell.i, cell.j + cell.size)] = 1;
+        kept[at(cell.i + cell.size, cell.j + cell.size)] = 1;
+    }
+
+    // Counter-clockwise boundary of each leaf, through the kept pixels
+    std::vector<std::vector<size_t>> outlines(leaves.size());
+
+    for (size_t l = 0; l < leaves.size(); l++)
+    {
+        const MeshCell& cell = leaves[l];
+        std::vector<size_t>& outline = outlines[l];
+        int s = cell.size;
+
+        for (int a = 0; a < s; a++)
+            if (kept[at(cell.i + a, cell.j)])
+                outline.push_back(at(cell.i + a, cell.j));
+        for (int b = 0; b < s; b++)
+            if (kept[at(cell.i + s, cell.j + b)])
+                outline.push_back(at(cell.i + s, cell.j + b));
+        for (int a = s; a > 0; a--)
+            if (kept[at(cell.i + a, cell.j + s)])
+                outline.push_back(at(cell.i + a, cell.j + s));
+        for (int b = s; b > 0; b--)
+            if (kept[at(cell.i, cell.j + b)])
+                outline.push_back(at(cell.i, cell.j + b));
+    }
+
+    for (size_t l = 0; l < leaves.size(); l++)
+        if (outlines[l].size() > 4)
+            kept[at(leaves[l].i + leaves[l].size / 2, leaves[l].j + leaves[l].size / 2)] = 1;
+
+    // Vertices in the order of writeMesh, numbered from 1
+    std::vector<int> number(kept.size(), 0);
+    int vertices = 0;
+    for (size_t k = 0; k < kept.size(); k++)
+        if (kept[k])
+            number[k] = ++vertices;
+
+    int quadrilaterals = 0;
+    int triangles = 0;
+    for (const std::vector<size_t>& outline : outlines)
+    {
+        if (outline.size() == 4)
+            quadrilaterals++;
+        else
+            triangles += outline.size();
+    }
+
+    writeHeader(mesh);
+
+    mesh << "Vertices\n";
+    mesh << vertices << "\n";
+
+    for (int j = 0; j < M.cols; j++)
+    {
+        for (int i = 0; i < M.rows; i++)
+        {
+            if (kept[at(i, j)])
+                mesh << i << " " << j << " " << M.values[i][j] << " 0\n";
+        }
+    }
+
+    mesh << "\n";
+    mesh << "Quadrilaterals\n";
+    mesh << quadrilaterals << "\n";
+
+    for (const std::vector<size_t>& outline : outlines)
+    {
+        if (outline.size() == 4)
+        {
+            mesh
+                << number[outline[0]] << " "
+                << number[outline[1]] << " "
+                << number[outline[2]] << " "
+                << number[outline[3]] << " 0\n";
+        }
+    }
+
+    mesh << "\n";
+    mesh << "Triangles\n";
+    mesh << triangles << "\n";
+
+    for (size_t l = 0; l < leaves.size(); l++)
+    {
+        const std::vector<size_t>& outline = outlines[l];
+        if (outline.size() == 4)
+            continue;
+
+        int centre = number[at(leaves[l].i + leaves[l].size / 2, leaves[l].j + leaves[l].size / 2)];
+
+        for (size_t v = 0; v < outline.size(); v++)
+        {
+            mesh
+                << centre << " "
+                << number[outline[v]] << " "
+                << number[outline[(v + 1) % outline.size()]] << " 0\n";
+        }
+    }
+}
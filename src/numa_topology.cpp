@@ -0,0 +1,94 @@
+// CPU and NUMA node layout, and thread pinning
+
+#include "../include/numa_topology.hpp"
+
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include <sched.h>
+
+// Parse a kernel CPU list such as "0-3,8-11"
+static std::vector<int> parseCpuList(const std::string& list)
+{
+    std::vector<int> cpus;
+    std::stringstream ranges(list);
+    std::string range;
+
+    while (std::getline(ranges, range, ','))
+    {
+        int first, last;
+        char dash;
+        std::stringstream bounds(range);
+
+        if (!(bounds >> first))
+            continue;
+        if (!(bounds >> dash >> last))
+            last = first;
+
+        for (int cpu = first; cpu <= last; cpu++)
+            cpus.push_back(cpu);
+    }
+
+    return cpus;
+}
+
+NumaTopology readNumaTopology()
+{
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+        CPU_SET(0, &allowed);
+
+    NumaTopology topology;
+
+    for (int node = 0; ; node++)
+    {
+        std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+        if (!file)
+            break;
+
+        std::string list;
+        std::getline(file, list);
+
+        std::vector<int> cpus;
+        for (int cpu : parseCpuList(list))
+            if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed))
+                cpus.push_back(cpu);
+
+        if (!cpus.empty())
+            topology.node_cpus.push_back(cpus);
+    }
+
+    if (topology.node_cpus.empty())
+    {
+        std::vector<int> cpus;
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+            if (CPU_ISSET(cpu, &allowed))
+                cpus.push_back(cpu);
+
+        topology.node_cpus.push_back(cpus);
+    }
+
+    return topology;
+}
+
+int workerCpu(const NumaTopology& topology, int w, int num_workers)
+{
+    int nodes = topology.node_cpus.size();
+    int node = int(long(w) * nodes / num_workers);
+
+    // Rank of the worker among those of its node
+    int first = (long(node) * num_workers + nodes - 1) / nodes;
+    const std::vector<int>& cpus = topology.node_cpus[node];
+
+    return cpus[(w - first) % cpus.size()];
+}
+
+bool pinToCpu(int cpu)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+}
@@ -1,11 +1,19 @@
 #include "../include/matrix.hpp"
 #include "../include/vector.hpp"
 #include "../include/globals.hpp"
+#include "../include/reflectance.hpp"
+#include "../include/perf_counters.hpp"
 #include <cmath>
 
-// Definition of the objective function to be minimized
-double objectiveFunction(const Vector<double>& x, const Matrix& image)
+// Definition of the objective function to be minimized, for the
+// reflectance model and image type given as template parameters
+template <typename Model, typename Image>
+double shadingObjective(const Vector<double>& x, const ShadingData<Model, Image>& data)
 {
+    const Image& image = *data.image;
+    const EnergyWeights& weights = data.weights;
+    PerfScope perf("shading objective", long(image.rows) * image.cols);
+
     Matrix p = x(0, image.rows * image.cols - 1)
                    .toMatrix(image.rows, image.cols);
 
@@ -22,8 +30,7 @@ double objectiveFunction(const Vector<double>& x, const Matrix& image)
         for (int j = 1; j <= image.cols; j++)
         {
             data_term += std::pow(
-                image(i, j) -
-                (255.0 / std::sqrt(1 + std::pow(p(i, j), 2) + std::pow(q(i, j), 2))),
+                greyLevel(image, i - 1, j - 1) - data.model.radiance(p(i, j), q(i, j)),
                 2
             );
 
@@ -43,9 +50,31 @@ double objectiveFunction(const Vector<double>& x, const Matrix& image)
         }
     }
 
-    data_term *= step_size * step_size;
-    integrability_term *= lambda_internal;
-    smoothness_term *= lambda_csmo;
+    data_term *= weights.step_size * weights.step_size;
+    integrability_term *= weights.lambda_internal;
+    smoothness_term *= weights.lambda_csmo;
 
     return data_term + integrability_term + smoothness_term;
 }
+
+// Objective function with frontal light on a Lambertian surface
+double objectiveFunction(const Vector<double>& x, const Matrix& image, const EnergyWeights& weights)
+{
+    ShadingData<FrontalLambertian> data = { &image, FrontalLambertian(), weights };
+    return shadingObjective(x, data);
+}
+
+template double shadingObjective(const Vector<double>&, const ShadingData<FrontalLambertian>&);
+template double shadingObjective(const Vector<double>&, const ShadingData<Lambertian>&);
+template double shadingObjective(const Vector<double>&, const ShadingData<LommelSeeliger>&);
+template double shadingObjective(const Vector<double>&, const ShadingData<HapkeLite>&);
+
+template double shadingObjective(const Vector<double>&, const ShadingData<FrontalLambertian, SensorImage<uint8_t>>&);
+template double shadingObjective(const Vector<double>&, const ShadingData<Lambertian, SensorImage<uint8_t>>&);
+template double shadingObjective(const Vector<double>&, const ShadingData<LommelSeeliger, SensorImage<uint8_t>>&);
+template double shadingObjective(const Vector<double>&, const ShadingData<HapkeLite, SensorImage<uint8_t>>&);
+
+template double shadingObjective(const Vector<double>&, const ShadingData<FrontalLambertian, SensorImage<uint16_t>>&);
+template double shadingObjective(const Vector<double>&, const ShadingData<Lambertian, SensorImage<uint16_t>>&);
+template double shadingObjective(const Vector<double>&, const ShadingData<LommelSeeliger, SensorImage<uint16_t>>&);
+template double shadingObjective(const Vector<double>&, const ShadingData<HapkeLite, SensorImage<uint16_t>>&);
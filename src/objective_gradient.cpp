@@ -3,11 +3,19 @@
 #include "../include/matrix.hpp"
 #include "../include/vector.hpp"
 #include "../include/globals.hpp"
+#include "../include/reflectance.hpp"
+#include "../include/perf_counters.hpp"
 #include <cmath>
 
-// Definition of the gradient of the objective function to be minimized
-Vector<double> computeGradient(const Vector<double>& x, const Matrix& image)
+// Definition of the gradient of the objective function to be minimized,
+// for the reflectance model and image type given as template parameters
+template <typename Model, typename Image>
+Vector<double> shadingGradient(const Vector<double>& x, const ShadingData<Model, Image>& data)
 {
+    const Image& image = *data.image;
+    const EnergyWeights& weights = data.weights;
+    PerfScope perf("shading gradient", long(image.rows) * image.cols);
+
     Matrix p = x(0, image.rows * image.cols - 1)
                    .toMatrix(image.rows, image.cols);
 
@@ -19,16 +27,18 @@ Vector<double> computeGradient(const Vector<double>& x, const Matrix& image)
     Matrix G2(2 * image.rows, image.cols);
     Matrix G3(2 * image.rows, image.cols);
 
-    // Gradient w.r.t. p
+    double R, R_p, R_q;
+
+    // Gradient w.r.t. p (data term for q filled in the same pass)
     for (int i = 1; i <= image.rows; i++)
     {
         for (int j = 1; j <= image.cols; j++)
         {
-            G1(i, j) =
-                -255.0 * p(i, j) *
-                (255.0 - image(i, j) *
-                std::sqrt(std::pow(q(i, j), 2) + std::pow(p(i, j), 2) + 1.0)) /
-                std::pow(std::pow(q(i, j), 2) + std::pow(p(i, j), 2) + 1.0, 2);
+            data.model.shade(p(i, j), q(i, j), R, R_p, R_q);
+
+            double residual = R - greyLevel(image, i - 1, j - 1);
+            G1(i, j) = residual * R_p;
+            G1(i + image.rows, j) = residual * R_q;
 
             if (i != 1 && j != 1 && i != image.rows && j != image.cols)
             {
@@ -49,14 +59,6 @@ Vector<double> computeGradient(const Vector<double>& x, const Matrix& image)
     {
         for (int j = 1; j <= image.cols; j++)
         {
-            G1(i, j) =
-                -255.0 * q(i - image.rows, j) *
-                (255.0 - image(i - image.rows, j) *
-                std::sqrt(std::pow(q(i - image.rows, j), 2)
-                        + std::pow(p(i - image.rows, j), 2) + 1.0)) /
-                std::pow(std::pow(q(i - image.rows, j), 2)
-                       + std::pow(p(i - image.rows, j), 2) + 1.0, 2);
-
             if (i != image.rows + 1 && j != 1 &&
                 i != 2 * image.rows && j != image.cols)
             {
@@ -79,9 +81,31 @@ Vector<double> computeGradient(const Vector<double>& x, const Matrix& image)
         }
     }
 
-    G1 *= step_size * step_size;
-    G2 *= lambda_internal;
-    G3 *= lambda_csmo;
+    G1 *= weights.step_size * weights.step_size;
+    G2 *= weights.lambda_internal;
+    G3 *= weights.lambda_csmo;
 
     return toVector((G1 + G2 + G3) * 2);
 }
+
+// Gradient with frontal light on a Lambertian surface
+Vector<double> computeGradient(const Vector<double>& x, const Matrix& image, const EnergyWeights& weights)
+{
+    ShadingData<FrontalLambertian> data = { &image, FrontalLambertian(), weights };
+    return shadingGradient(x, data);
+}
+
+template Vector<double> shadingGradient(const Vector<double>&, const ShadingData<FrontalLambertian>&);
+template Vector<double> shadingGradient(const Vector<double>&, const ShadingData<Lambertian>&);
+template Vector<double> shadingGradient(const Vector<double>&, const ShadingData<LommelSeeliger>&);
+template Vector<double> shadingGradient(const Vector<double>&, const ShadingData<HapkeLite>&);
+
+template Vector<double> shadingGradient(const Vector<double>&, const ShadingData<FrontalLambertian, SensorImage<uint8_t>>&);
+template Vector<double> shadingGradient(const Vector<double>&, const ShadingData<Lambertian, SensorImage<uint8_t>>&);
+template Vector<double> shadingGradient(const Vector<double>&, const ShadingData<LommelSeeliger, SensorImage<uint8_t>>&);
+template Vector<double> shadingGradient(const Vector<double>&, const ShadingData<HapkeLite, SensorImage<uint8_t>>&);
+
+template Vector<double> shadingGradient(const Vector<double>&, const ShadingData<FrontalLambertian, SensorImage<uint16_t>>&);
+template Vector<double> shadingGradient(const Vector<double>&, const ShadingData<Lambertian, SensorImage<uint16_t>>&);
+template Vector<double> shadingGradient(const Vector<double>&, const ShadingData<LommelSeeliger, SensorImage<uint16_t>>&);
+template Vector<double> shadingGradient(const Vector<double>&, const ShadingData<HapkeLite, SensorImage<uint16_t>>&);
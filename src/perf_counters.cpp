@@ -0,0 +1,251 @@
+// Hardware performance counters around kernels and phases
+
+#include "../include/perf_counters.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <string>
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace
+{
+
+const int counter_count = 4;
+const int value_count = counter_count + 2;     // counts, time enabled, time running
+const double line_bytes = 64.0;
+
+// Cycles (group leader), instructions, last-level cache misses, branch misses
+const uint64_t counter_config[counter_count] = {
+    PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_MISSES,
+    PERF_COUNT_HW_BRANCH_MISSES
+};
+
+struct PhaseTotals
+{
+    long calls = 0;
+    double seconds = 0.0;
+    double pixels = 0.0;
+    uint64_t counts[counter_count] = { 0, 0, 0, 0 };
+    bool counted = false;      // hardware counts available for every call
+    bool scaled = false;       // some counts scaled up for multiplexing
+};
+
+std::atomic<bool> enabled(false);
+std::mutex totals_mutex;
+std::map<std::string, PhaseTotals> totals;
+
+// Counter group of one thread, opened on first use. An inherited group
+// also counts the threads and processes the thread starts after opening it.
+struct ThreadCounters
+{
+    int fd[counter_count];
+    bool inherit;
+    bool opened = false;
+    bool available = false;
+
+    explicit ThreadCounters(bool inherit) : inherit(inherit)
+    {
+        for (int c = 0; c < counter_count; c++)
+            fd[c] = -1;
+    }
+
+    ~ThreadCounters()
+    {
+        for (int c = 0; c < counter_count; c++)
+            if (fd[c] >= 0)
+                close(fd[c]);
+    }
+
+    void open()
+    {
+        opened = true;
+        available = true;
+
+        for (int c = 0; c < counter_count && available; c++)
+        {
+            perf_event_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = counter_config[c];
+            attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED
+                             | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            attr.disabled = c == 0;
+            attr.inherit = inherit;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+
+            // This thread, any CPU
+            fd[c] = syscall(SYS_perf_event_open, &attr, 0, -1, c == 0 ? -1 : fd[0], 0);
+            available = fd[c] >= 0;
+        }
+
+        if (available)
+        {
+            ioctl(fd[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+            ioctl(fd[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        }
+    }
+
+    // Counts, then the times the group was enabled and running
+    bool read(uint64_t* values)
+    {
+        if (!opened)
+            open();
+        if (!available)
+            return false;
+
+        // Number of counters, time enabled, time running, then the counts
+        uint64_t group[3 + counter_count];
+        if (::read(fd[0], group, sizeof(group)) != ssize_t(sizeof(group)))
+            return false;
+
+        std::memcpy(values, group + 3, sizeof(uint64_t) * counter_count);
+        values[counter_count] = group[1];
+        values[counter_count + 1] = group[2];
+        return true;
+    }
+};
+
+thread_local ThreadCounters thread_counters(false);
+thread_local ThreadCounters tree_counters(true);
+
+double now()
+{
+    return std::chrono::duration<double>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+} // namespace
+
+void setPerfEnabled(bool on)
+{
+    enabled = on;
+}
+
+bool perfEnabled()
+{
+    return enabled;
+}
+
+PerfScope::PerfScope(const char* phase, long pixels, bool with_children)
+    : phase(phase), pixels(pixels), active(enabled), with_children(with_children),
+      start_seconds(0.0)
+{
+    if (!active)
+        return;
+
+    if (!(with_children ? tree_counters : thread_counters).read(start))
+        start[0] = UINT64_MAX;
+
+    start_seconds = now();
+}
+
+PerfScope::~PerfScope()
+{
+    if (!active)
+        return;
+
+    double seconds = now() - start_seconds;
+
+    uint64_t end[value_count];
+    bool counted = start[0] != UINT64_MAX
+                   && (with_children ? tree_counters : thread_counters).read(end);
+
+    // A multiplexed group only counted while running: scale up to the
+    // time it was enabled
+    uint64_t enabled_ns = counted ? end[counter_count] - start[counter_count] : 0;
+    uint64_t running_ns = counted ? end[counter_count + 1] - start[counter_count + 1] : 0;
+    counted = counted && running_ns > 0;
+    double scale = counted ? double(enabled_ns) / double(running_ns) : 1.0;
+
+    std::lock_guard<std::mutex> lock(totals_mutex);
+    PhaseTotals& phase_totals = totals[phase];
+
+    phase_totals.counted = counted && (phase_totals.calls == 0 || phase_totals.counted);
+    phase_totals.calls++;
+    phase_totals.seconds += seconds;
+    phase_totals.pixels += pixels;
+
+    if (counted)
+    {
+        phase_totals.scaled = phase_totals.scaled || running_ns < enabled_ns;
+        for (int c = 0; c < counter_count; c++)
+            phase_totals.counts[c] += uint64_t(double(end[c] - start[c]) * scale + 0.5);
+    }
+}
+
+void printPerfReport(std::ostream& out)
+{
+    std::lock_guard<std::mutex> lock(totals_mutex);
+
+    bool any_counted = false;
+    for (const auto& entry : totals)
+        any_counted = any_counted || entry.second.counted;
+
+    out << "Performance counters"
+        << (any_counted ? "" : " unavailable (perf_event_open refused): wall time only") << "\n";
+
+    out << std::left << std::setw(24) << "phase" << std::right
+        << std::setw(8) << "calls" << std::setw(11) << "seconds"
+        << std::setw(10) << "ns/pixel" << std::setw(7) << "IPC"
+        << std::setw(12) << "LLC miss/px" << std::setw(10) << "bytes/px"
+        << std::setw(10) << "GB/s" << std::setw(12) << "br miss/px" << "\n";
+
+    out << std::fixed;
+
+    for (const auto& entry : totals)
+    {
+        const PhaseTotals& t = entry.second;
+        double pixels = t.pixels > 0.0 ? t.pixels : 1.0;
+
+        out << std::left << std::setw(24) << entry.first << std::right
+            << std::setw(8) << t.calls
+            << std::setw(11) << std::setprecision(3) << t.seconds
+            << std::setw(10) << std::setprecision(2) << 1e9 * t.seconds / pixels;
+
+        if (t.counted)
+        {
+            double cycles = double(t.counts[0]);
+            double bytes = line_bytes * double(t.counts[2]);
+
+            out << std::setw(7) << std::setprecision(2) << (cycles > 0.0 ? t.counts[1] / cycles : 0.0)
+                << std::setw(12) << std::setprecision(4) << t.counts[2] / pixels
+                << std::setw(10) << std::setprecision(2) << bytes / pixels
+                << std::setw(10) << std::setprecision(2) << (t.seconds > 0.0 ? bytes / t.seconds / 1e9 : 0.0)
+                << std::setw(12) << std::setprecision(4) << t.counts[3] / pixels;
+        }
+        else
+        {
+            out << std::setw(7) << "-" << std::setw(12) << "-" << std::setw(10) << "-"
+                << std::setw(10) << "-" << std::setw(12) << "-";
+        }
+
+        out << "\n";
+    }
+
+    out << std::defaultfloat;
+
+    std::string scaled;
+    for (const auto& entry : totals)
+        if (entry.second.counted && entry.second.scaled)
+            scaled += (scaled.empty() ? "" : ", ") + entry.first;
+
+    if (!scaled.empty())
+        out << "Counts scaled for counter multiplexing (estimates): " << scaled << "\n";
+
+    if (any_counted)
+        out << "Kernel phases count their own thread; solve and region also count "
+               "the line-search threads and --workers processes they start\n";
+    out << "Kernels run inside --workers processes are not listed\n";
+}
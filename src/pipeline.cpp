@@ -0,0 +1,127 @@
+// Load → solve → export pipeline over bounded queues
+
+#include "../include/pipeline.hpp"
+#include "../include/bounded_queue.hpp"
+#include "../include/perf_counters.hpp"
+#include "../include/image_factory.hpp"
+#include "../include/lbfgs.hpp"
+#include "../include/matrix.hpp"
+
+#include <chrono>
+#include <iostream>
+#include <new>
+#include <string>
+#include <thread>
+
+// A frame travelling through the stages
+struct PipelineItem
+{
+    int job;           // index in the job list
+    Matrix frame;      // image before the solve, height map after
+    std::string error; // why the job failed (empty: fine so far)
+};
+
+static double secondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int runPipeline(
+    const std::vector<PipelineJob>& jobs,
+    const std::function<Matrix(const Matrix&)>& solve,
+    int queue_capacity,
+    double mesh_tolerance
+)
+{
+    BoundedQueue<PipelineItem> loaded(queue_capacity);
+    BoundedQueue<PipelineItem> solved(queue_capacity);
+
+    // Time each stage spends working (not waiting on a queue)
+    double load_time = 0.0;
+    double solve_time = 0.0;
+    double export_time = 0.0;
+    int failed = 0;
+
+    auto pipeline_start = std::chrono::steady_clock::now();
+
+    // Loader: parse the inputs ahead of the solver
+    std::thread loader([&]()
+    {
+        for (int k = 0; k < int(jobs.size()); k++)
+        {
+            auto start = std::chrono::steady_clock::now();
+            PerfScope perf("load", 0);
+            PipelineItem item;
+            item.job = k;
+            try
+            {
+                readCsvMatrix(jobs[k].input.c_str(), item.frame, item.error);
+            }
+            catch (const std::bad_alloc&)
+            {
+                item.error = "out of memory loading " + jobs[k].input;
+            }
+            perf.setPixels(long(item.frame.rows) * item.frame.cols);
+            load_time += secondsSince(start);
+
+            if (!loaded.push(std::move(item)))
+                break;
+        }
+        loaded.close();
+    });
+
+    // Writer: serialize the meshes behind the solver
+    std::thread writer([&]()
+    {
+        PipelineItem item;
+        while (solved.pop(item))
+        {
+            auto start = std::chrono::steady_clock::now();
+            {
+                PerfScope perf("export", long(item.frame.rows) * item.frame.cols);
+                matrixToMesh(jobs[item.job].output, item.frame, mesh_tolerance);
+            }
+            export_time += secondsSince(start);
+
+            std::cout << "Exported " << jobs[item.job].output << "\n";
+        }
+    });
+
+    // Solver: the calling thread. A job that failed to load is reported
+    // here, in job order, and the batch goes on with the next one.
+    PipelineItem item;
+    while (loaded.pop(item))
+    {
+        if (!item.error.empty())
+        {
+            std::cerr << "Failed " << jobs[item.job].input << ": " << item.error << "\n";
+            failed++;
+            continue;
+        }
+
+        std::cout << "Solving " << jobs[item.job].input << "\n";
+
+        auto start = std::chrono::steady_clock::now();
+        {
+            PerfScope perf("solve", long(item.frame.rows) * item.frame.cols, true);
+            item.frame = solve(item.frame);
+        }
+        solve_time += secondsSince(start);
+
+        solved.push(std::move(item));
+    }
+    solved.close();
+
+    loader.join();
+    writer.join();
+
+    std::cout << "Pipeline: " << jobs.size() << " jobs in "
+              << secondsSince(pipeline_start) << " s (load " << load_time
+              << " s, solve " << solve_time << " s, export " << export_time
+              << " s)\n";
+
+    if (failed > 0)
+        std::cout << "Pipeline: " << failed << " of " << jobs.size() << " jobs failed\n";
+
+    return failed;
+}
@@ -0,0 +1,182 @@
+// Incremental re-solve of a rectangular region of an existing reconstruction
+
+#include "../include/lbfgs.hpp"
+#include "../include/matrix.hpp"
+#include "../include/perf_counters.hpp"
+#include "../include/vector.hpp"
+
+#include <algorithm>
+#include <string>
+
+// Objective on the window: the frozen ring enters the integrability and
+// smoothness terms of its neighbours as a boundary condition
+static double regionObjective(const Vector<double>& x, const RegionWindow& window)
+{
+    PerfScope perf("region objective", long(window.image.rows) * window.image.cols);
+    return objectiveFunction(x, window.image, window.weights);
+}
+
+// Gradient on the window, zeroed on the frozen ring so it keeps the
+// values of the surrounding solution
+static Vector<double> regionGradient(const Vector<double>& x, const RegionWindow& window)
+{
+    PerfScope perf("region gradient", long(window.image.rows) * window.image.cols);
+    Vector<double> gradient = computeGradient(x, window.image, window.weights);
+
+    int rows = window.image.rows;
+    int cols = window.image.cols;
+    int n = rows * cols;
+
+    for (int i = 0; i < rows; i++)
+    {
+        for (int j = 0; j < cols; j++)
+        {
+            if ((i == 0 && window.frozen_top) ||
+                (i == rows - 1 && window.frozen_bottom) ||
+                (j == 0 && window.frozen_left) ||
+                (j == cols - 1 && window.frozen_right))
+            {
+                gradient.values[i * cols + j] = 0.0;
+                gradient.values[n + i * cols + j] = 0.0;
+            }
+        }
+    }
+
+    return gradient;
+}
+
+// Line restriction on the window (the frozen ring has zero direction)
+static LineModel regionLinePrepare(
+    const Vector<double>& x,
+    const Vector<double>& d,
+    const RegionWindow& window
+)
+{
+    PerfScope perf("region line prepare", long(window.image.rows) * window.image.cols);
+    return objectiveLinePrepare(x, d, window.image, window.weights);
+}
+
+static double regionLineRemainder(
+    const Vector<double>& x,
+    const Vector<double>& d,
+    double alpha,
+    const RegionWindow& window,
+    double& slope
+)
+{
+    PerfScope perf("region line remainder", long(window.image.rows) * window.image.cols);
+    return objectiveLineRemainder(x, d, alpha, window.image, window.weights, slope);
+}
+
+bool resolveRegion(
+    Vector<double>& x,
+    Matrix& height,
+    const Matrix& image,
+    const EnergyWeights& weights,
+    int row_min, int col_min,
+    int row_max, int col_max,
+    int halo,
+    double grad_tol_1,
+    double grad_tol_2,
+    std::string& error
+)
+{
+    int rows = image.rows;
+    int cols = image.cols;
+    int n = rows * cols;
+
+    if (row_min < 1 || col_min < 1 || row_max > rows || col_max > cols ||
+        row_min > row_max || col_min > col_max || halo < 0)
+    {
+        error = "invalid region for re-solve";
+        return false;
+    }
+
+    if (x.dimension != 2 * n || height.rows != rows || height.cols != cols)
+    {
+        error = "previous solution does not match the image";
+        return false;
+    }
+
+    // Window = dirty rectangle + halo + one frozen ring, clipped to the frame
+    RegionWindow window;
+    window.weights = weights;
+    window.frozen_top    = row_min - halo - 1 >= 1;
+    window.frozen_bottom = row_max + halo + 1 <= rows;
+    window.frozen_left   = col_min - halo - 1 >= 1;
+    window.frozen_right  = col_max + halo + 1 <= cols;
+
+    int r0 = std::max(1, row_min - halo - 1);
+    int r1 = std::min(rows, row_max + halo + 1);
+    int c0 = std::max(1, col_min - halo - 1);
+    int c1 = std::min(cols, col_max + halo + 1);
+
+    int wr = r1 - r0 + 1;
+    int wc = c1 - c0 + 1;
+    int wn = wr * wc;
+
+    if (wr < 2 || wc < 2)
+    {
+        error = "region window must be at least 2x2";
+        return false;
+    }
+
+    window.image = Matrix(wr, wc);
+    Vector<double> x0(2 * wn);
+    Vector<double> h0(wn);
+
+    for (int i = 0; i < wr; i++)
+    {
+        for (int j = 0; j < wc; j++)
+        {
+            int global = (r0 - 1 + i) * cols + (c0 - 1 + j);
+
+            window.image.values[i][j] = image.values[r0 - 1 + i][c0 - 1 + j];
+            x0.values[i * wc + j] = x.values[global];
+            x0.values[wn + i * wc + j] = x.values[n + global];
+            h0.values[i * wc + j] = height.values[r0 - 1 + i][c0 - 1 + j];
+        }
+    }
+
+    // First optimization on the window: directional derivatives of height
+    LineSearch<RegionWindow> region_line = { regionLinePrepare, regionLineRemainder };
+
+    Vector<double> x_window = LBFGS(
+        x0,
+        regionObjective,
+        regionGradient,
+        window,
+        grad_tol_1,
+        &region_line
+    );
+
+    // Second optimization on the window: height (heightGradient already
+    // keeps the outer ring fixed)
+    Matrix height_derivatives = x_window.toMatrix(2 * wr, wc);
+    HeightData height_data = { &height_derivatives, weights };
+    LineSearch<HeightData> height_line = { heightLinePrepare, nullptr };
+
+    Vector<double> h_window = LBFGS(
+        h0,
+        heightObjective,
+        heightGradient,
+        height_data,
+        grad_tol_2,
+        &height_line
+    );
+
+    // Patch the full-frame solution
+    for (int i = 0; i < wr; i++)
+    {
+        for (int j = 0; j < wc; j++)
+        {
+            int global = (r0 - 1 + i) * cols + (c0 - 1 + j);
+
+            x.values[global] = x_window.values[i * wc + j];
+            x.values[n + global] = x_window.values[wn + i * wc + j];
+            height.values[r0 - 1 + i][c0 - 1 + j] = h_window.values[i * wc + j];
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,255 @@
+// Content-addressed result cache
+
+#include "../include/result_cache.hpp"
+#include "../include/globals.hpp"
+#include "../include/matrix.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+static const char cache_magic[8] = { 'S', 'F', 'S', 'C', 'A', 'C', 'H', '1' };
+
+// 64-bit FNV-1a
+static const uint64_t fnv_offset = 1469598103934665603ULL;
+static const uint64_t fnv_prime = 1099511628211ULL;
+
+static uint64_t fnv1a(const void* data, size_t size, uint64_t hash)
+{
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for (size_t k = 0; k < size; k++)
+    {
+        hash ^= bytes[k];
+        hash *= fnv_prime;
+    }
+    return hash;
+}
+
+static uint64_t hashMatrix(const Matrix& M, uint64_t hash)
+{
+    int32_t shape[2] = { M.rows, M.cols };
+    hash = fnv1a(shape, sizeof(shape), hash);
+    for (int i = 0; i < M.rows; i++)
+        hash = fnv1a(M.values[i], M.cols * sizeof(double), hash);
+    return hash;
+}
+
+ResultCache::ResultCache(const std::string& directory, long max_bytes)
+    : directory(directory), max_bytes(max_bytes)
+{
+    std::error_code error;
+    fs::create_directories(directory, error);
+
+    if (error)
+    {
+        std::cerr << "Error: unable to create cache directory " << directory << ".\n";
+        std::exit(1);
+    }
+}
+
+std::string ResultCache::key(const Matrix& image, const EnergyWeights& weights,
+                             const std::string& settings) const
+{
+    uint64_t hash = hashMatrix(image, fnv_offset);
+
+    double energy[3] = { weights.lambda_internal, weights.lambda_csmo, weights.step_size };
+    hash = fnv1a(energy, sizeof(energy), hash);
+
+    hash = fnv1a(settings.data(), settings.size(), hash);
+
+    char hex[17];
+    std::snprintf(hex, sizeof(hex), "%016llx", static_cast<unsigned long long>(hash));
+    return hex;
+}
+
+std::string ResultCache::entryPath(const std::string& key) const
+{
+    return directory + "/" + key + ".sfs";
+}
+
+// Entry layout: magic, then for each matrix its int32 shape and values,
+// then the FNV-1a checksum of everything after the magic
+static void writeMatrix(std::vector<char>& buffer, const Matrix& M)
+{
+    int32_t shape[2] = { M.rows, M.cols };
+    buffer.insert(buffer.end(), reinterpret_cast<char*>(shape), reinterpret_cast<char*>(shape + 2));
+    for (int i = 0; i < M.rows; i++)
+        buffer.insert(buffer.end(),
+                      reinterpret_cast<char*>(M.values[i]),
+                      reinterpret_cast<char*>(M.values[i] + M.cols));
+}
+
+static bool readMatrix(const std::vector<char>& buffer, size_t& offset, size_t end, Matrix& M)
+{
+    int32_t shape[2];
+    if (offset + sizeof(shape) > end)
+        return false;
+    std::memcpy(shape, buffer.data() + offset, sizeof(shape));
+    offset += sizeof(shape);
+
+    if (shape[0] < 0 || shape[1] < 0)
+        return false;
+
+    size_t bytes = size_t(shape[0]) * shape[1] * sizeof(double);
+    if (offset + bytes > end)
+        return false;
+
+    M = Matrix(shape[0], shape[1]);
+    for (int i = 0; i < M.rows; i++)
+    {
+        std::memcpy(M.values[i], buffer.data() + offset, M.cols * sizeof(double));
+        offset += M.cols * sizeof(double);
+    }
+    return true;
+}
+
+bool ResultCache::load(const std::string& key, CachedResult& result) const
+{
+    std::string path = entryPath(key);
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return false;
+
+    std::vector<char> buffer((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    size_t header = sizeof(cache_magic);
+    if (buffer.size() < header + sizeof(uint64_t) ||
+        std::memcmp(buffer.data(), cache_magic, header))
+        return false;
+
+    size_t end = buffer.size() - sizeof(uint64_t);
+    uint64_t checksum;
+    std::memcpy(&checksum, buffer.data() + end, sizeof(checksum));
+    if (checksum != fnv1a(buffer.data() + header, end - header, fnv_offset))
+        return false;
+
+    size_t offset = header;
+    if (!readMatrix(buffer, offset, end, result.derivatives) ||
+        !readMatrix(buffer, offset, end, result.height) ||
+        offset != end)
+        return false;
+
+    // Mark as recently used
+    std::error_code error;
+    fs::last_write_time(path, fs::file_time_type::clock::now(), error);
+
+    return true;
+}
+
+void ResultCache::store(const std::string& key, const CachedResult& result) const
+{
+    std::vector<char> buffer(cache_magic, cache_magic + sizeof(cache_magic));
+    writeMatrix(buffer, result.derivatives);
+    writeMatrix(buffer, result.height);
+
+    uint64_t checksum = fnv1a(buffer.data() + sizeof(cache_magic),
+                              buffer.size() - sizeof(cache_magic), fnv_offset);
+    buffer.insert(buffer.end(),
+                  reinterpret_cast<char*>(&checksum),
+                  reinterpret_cast<char*>(&checksum + 1));
+
+    // Write a private temporary (unique to this call, whatever the thread
+    // or process), flush it to disk, then rename into place
+    std::string path = entryPath(key);
+    std::vector<char> name(path.begin(), path.end());
+    const char suffix[] = ".tmp.XXXXXX";
+    name.insert(name.end(), suffix, suffix + sizeof(suffix));
+
+    int fd = mkstemp(name.data());
+    std::string temporary = name.data();
+    if (fd < 0)
+    {
+        std::cerr << "Warning: unable to write cache entry " << temporary << ".\n";
+        return;
+    }
+    fchmod(fd, 0644);
+
+    size_t written = 0;
+    while (written < buffer.size())
+    {
+        ssize_t n = write(fd, buffer.data() + written, buffer.size() - written);
+        if (n <= 0)
+            break;
+        written += n;
+    }
+
+    bool complete = written == buffer.size() && fsync(fd) == 0;
+    close(fd);
+
+    if (!complete || std::rename(temporary.c_str(), path.c_str()) != 0)
+    {
+        std::cerr << "Warning: unable to write cache entry " << path << ".\n";
+        std::remove(temporary.c_str());
+        return;
+    }
+
+    evict();
+}
+
+// Temporaries older than this were left by a writer that died
+static const std::chrono::hours stale_temporary_age(1);
+
+// Drop least recently used entries until the directory fits in max_bytes,
+// and stale temporaries
+void ResultCache::evict() const
+{
+    struct Entry
+    {
+        fs::path path;
+        fs::file_time_type time;
+        uintmax_t size;
+    };
+
+    std::vector<Entry> entries;
+    uintmax_t total = 0;
+
+    fs::file_time_type now = fs::file_time_type::clock::now();
+
+    std::error_code error;
+    for (const fs::directory_entry& file : fs::directory_iterator(directory, error))
+    {
+        if (!file.is_regular_file(error))
+            continue;
+
+        if (file.path().filename().string().find(".sfs.tmp.") != std::string::npos)
+        {
+            fs::file_time_type time = file.last_write_time(error);
+            if (!error && now - time > stale_temporary_age)
+                fs::remove(file.path(), error);
+            continue;
+        }
+
+        if (file.path().extension() != ".sfs")
+            continue;
+
+        Entry entry = { file.path(), file.last_write_time(error), file.file_size(error) };
+        if (error)
+            continue;
+
+        entries.push_back(entry);
+        total += entry.size;
+    }
+
+    std::sort(entries.begin(), entries.end(),
+              [](const Entry& a, const Entry& b) { return a.time < b.time; });
+
+    // Keep at least the newest entry
+    for (size_t k = 0; k + 1 < entries.size() && total > uintmax_t(max_bytes); k++)
+    {
+        if (fs::remove(entries[k].path, error))
+            total -= entries[k].size;
+    }
+}
@@ -0,0 +1,357 @@
+// libsfs: reentrant reconstruction entry points (C++ and C)
+
+#include "../include/sfs.hpp"
+#include "../include/reflectance.hpp"
+#include "../include/sensor_image.hpp"
+#include "../include/globals.hpp"
+#include "../include/continuation.hpp"
+#include "../include/lbfgs.hpp"
+#include "../include/matrix.hpp"
+#include "../include/vector.hpp"
+
+#include <chrono>
+#include <climits>
+#include <cstring>
+#include <new>
+
+void sfs_default_params(sfs_params* params)
+{
+    params->lambda_internal = 10.0;
+    params->lambda_csmo = 10.0;
+    params->step_size = 1.0;
+
+    params->grad_tol_1 = 100.0;
+    params->grad_tol_2 = 1e-3;
+    params->lbfgs_memory = 5;
+    params->continuation_stages = 1;
+    params->continuation_factor = 10.0;
+
+    params->model = SFS_MODEL_FRONTAL;
+    params->light[0] = 0.0;
+    params->light[1] = 0.0;
+    params->light[2] = 1.0;
+
+    params->direct = 0;
+    params->time_budget = 0.0;
+    params->line_threads = 1;
+    params->verbose = 0;
+}
+
+const char* sfs_status_string(int status)
+{
+    switch (status)
+    {
+    case SFS_OK:               return "ok";
+    case SFS_INVALID_ARGUMENT: return "invalid argument";
+    case SFS_OUT_OF_MEMORY:    return "out of memory";
+    case SFS_INCOMPLETE:       return "time budget exhausted";
+    case SFS_CANCELLED:        return "cancelled";
+    case SFS_INTERNAL_ERROR:   return "internal error";
+    default:                   return "unknown status";
+    }
+}
+
+static bool validParameters(const sfs_params& params)
+{
+    if (params.model != SFS_MODEL_FRONTAL &&
+        params.light[0] == 0.0 && params.light[1] == 0.0 && params.light[2] == 0.0)
+        return false;
+
+    return params.lambda_internal >= 0.0 && params.lambda_csmo >= 0.0 &&
+           params.step_size > 0.0 &&
+           params.grad_tol_1 > 0.0 && params.grad_tol_2 > 0.0 &&
+           params.lbfgs_memory >= 1 && params.lbfgs_memory <= SFS_MAX_LBFGS_MEMORY &&
+           params.continuation_stages >= 1 &&
+           params.continuation_stages <= SFS_MAX_CONTINUATION_STAGES &&
+           params.continuation_factor >= 1.0 &&
+           params.model >= SFS_MODEL_FRONTAL && params.model <= SFS_MODEL_HAPKE &&
+           params.time_budget >= 0.0 &&
+           params.line_threads >= 1 && params.line_threads <= SFS_MAX_LINE_THREADS;
+}
+
+// L-BFGS settings of one stage, which ends at start + share of the budget
+static LBFGSControl stageControl(
+    const sfs_params& params,
+    const SfsContext* context,
+    LBFGSControl::Clock::time_point start,
+    double share
+)
+{
+    LBFGSControl control;
+    control.memory = params.lbfgs_memory;
+
+    if (context)
+    {
+        control.cancel = context->cancel;
+        control.workspace = context->workspace;
+        control.trial_pool = context->trial_pool;
+    }
+
+    control.verbose = params.verbose != 0;
+    control.parallel_trials = params.line_threads;
+    control.kernel_threads = params.line_threads;
+
+    if (params.time_budget > 0.0)
+    {
+        control.has_deadline = true;
+        control.deadline = start + std::chrono::duration_cast<LBFGSControl::Clock::duration>(
+            std::chrono::duration<double>(share * params.time_budget));
+    }
+
+    return control;
+}
+
+static EnergyWeights paramWeights(const sfs_params& params)
+{
+    EnergyWeights weights;
+    weights.lambda_internal = params.lambda_internal;
+    weights.lambda_csmo = params.lambda_csmo;
+    weights.step_size = params.step_size;
+    return weights;
+}
+
+static bool stoppedOn(const LBFGSControl& control, const char* reason)
+{
+    return !std::strcmp(control.stop_reason, reason);
+}
+
+// Grey levels of any image type as a Matrix
+template <typename Image>
+static Matrix greyMatrix(const Image& image)
+{
+    Matrix grey(image.rows, image.cols);
+    for (int i = 0; i < image.rows; i++)
+        for (int j = 0; j < image.cols; j++)
+            grey.values[i][j] = greyLevel(image, i, j);
+    return grey;
+}
+
+// First stage for one reflectance model
+template <typename Model, typename Image>
+static Vector<double> solveDerivatives(const Image& image, const Model& model,
+                                       const sfs_params& params, LBFGSControl& control)
+{
+    ShadingData<Model, Image> data = { &image, model, paramWeights(params) };
+    LineSearch<ShadingData<Model, Image>> line = {
+        shadingLinePrepare<Model, Image>,
+        shadingLineRemainder<Model, Image>
+    };
+
+    ContinuationSchedule schedule;
+    schedule.stages = params.continuation_stages;
+    schedule.factor = params.continuation_factor;
+
+    Vector<double> x0(2 * image.rows * image.cols, 0.5);
+    return continuationLBFGS(x0, shadingObjective<Model, Image>, shadingGradient<Model, Image>,
+                             data, params.grad_tol_1, &line, &control, schedule);
+}
+
+template <typename Image>
+static int reconstructImage(const Image& image, const sfs_params& params,
+                            double* height, SfsContext* context)
+{
+    LBFGSControl::Clock::time_point start = LBFGSControl::Clock::now();
+
+    EnergyWeights weights = paramWeights(params);
+
+    Vec3d light{{ params.light[0], params.light[1], params.light[2] }};
+    int n = image.rows * image.cols;
+
+    // The first stage gets three quarters of the budget, the second the rest
+    LBFGSControl first = stageControl(params, context, start, 0.75);
+    LBFGSControl second = stageControl(params, context, start, 1.0);
+    int status;
+
+    if (params.direct)
+    {
+        Matrix grey = greyMatrix(image);
+        Vector<double> h;
+
+        switch (params.model)
+        {
+        case SFS_MODEL_LAMBERT:
+            h = directHeightReconstruct(grey, Lambertian(light), weights, params.grad_tol_1, &second);
+            break;
+        case SFS_MODEL_LOMMEL_SEELIGER:
+            h = directHeightReconstruct(grey, LommelSeeliger(light), weights, params.grad_tol_1, &second);
+            break;
+        case SFS_MODEL_HAPKE:
+            h = directHeightReconstruct(grey, HapkeLite(light), weights, params.grad_tol_1, &second);
+            break;
+        default:
+            h = directHeightReconstruct(grey, FrontalLambertian(), weights, params.grad_tol_1, &second);
+        }
+
+        std::memcpy(height, h.values, n * sizeof(double));
+
+        status = stoppedOn(second, "cancelled") ? SFS_CANCELLED :
+                 stoppedOn(second, "deadline") ? SFS_INCOMPLETE : SFS_OK;
+        first = second;
+        second = LBFGSControl();
+    }
+    else
+    {
+        Vector<double> x;
+
+        switch (params.model)
+        {
+        case SFS_MODEL_LAMBERT:
+            x = solveDerivatives(image, Lambertian(light), params, first);
+            break;
+        case SFS_MODEL_LOMMEL_SEELIGER:
+            x = solveDerivatives(image, LommelSeeliger(light), params, first);
+            break;
+        case SFS_MODEL_HAPKE:
+            x = solveDerivatives(image, HapkeLite(light), params, first);
+            break;
+        default:
+            x = solveDerivatives(image, FrontalLambertian(), params, first);
+        }
+
+        if (stoppedOn(first, "cancelled"))
+            return SFS_CANCELLED;
+
+        Matrix height_derivatives = x.toMatrix(2 * image.rows, image.cols);
+        HeightData height_data = { &height_derivatives, weights };
+        LineSearch<HeightData> height_line = { heightLinePrepare, nullptr };
+
+        Vector<double> h0(n, 0.0);
+        Vector<double> h = LBFGS(h0, heightObjective, heightGradient, height_data,
+                                 params.grad_tol_2, &height_line, &second);
+
+        std::memcpy(height, h.values, n * sizeof(double));
+
+        status = stoppedOn(second, "cancelled") ? SFS_CANCELLED :
+                 stoppedOn(first, "deadline") || stoppedOn(second, "deadline") ? SFS_INCOMPLETE :
+                 SFS_OK;
+    }
+
+    if (context)
+    {
+        context->iterations[0] = first.iterations;
+        context->iterations[1] = second.iterations;
+        context->objective[0] = first.objective;
+        context->objective[1] = second.objective;
+        context->seconds = std::chrono::duration<double>(LBFGSControl::Clock::now() - start).count();
+    }
+
+    return status;
+}
+
+// The solver indexes the 2 x rows x cols slopes with int
+static bool validSize(int rows, int cols)
+{
+    return rows >= 2 && cols >= 2 && long(rows) * cols <= INT_MAX / 2;
+}
+
+static bool validShape(const void* image, int rows, int cols, const double* height)
+{
+    return image && height && validSize(rows, cols);
+}
+
+// Run an entry point's solve, turning any exception into a status code:
+// nothing may propagate through the C interface
+template <typename Solve>
+static int guarded(const Solve& solve)
+{
+    try
+    {
+        return solve();
+    }
+    catch (const std::bad_alloc&)
+    {
+        return SFS_OUT_OF_MEMORY;
+    }
+    catch (...)
+    {
+        return SFS_INTERNAL_ERROR;
+    }
+}
+
+template <typename Sample>
+static int reconstructSamples(const Sample* image, int rows, int cols, double scale,
+                              const sfs_params& params, double* height, SfsContext* context)
+{
+    if (!validShape(image, rows, cols, height) || !(scale > 0.0) || !validParameters(params))
+        return SFS_INVALID_ARGUMENT;
+
+    return guarded([&]()
+    {
+        SensorImage<Sample> sensor;
+        sensor.rows = rows;
+        sensor.cols = cols;
+        sensor.scale = scale;
+        sensor.samples.assign(image, image + size_t(rows) * cols);
+
+        return reconstructImage(sensor, params, height, context);
+    });
+}
+
+// ====================== C++ interface ======================
+
+int sfsReconstruct(const Matrix& image, const sfs_params& params, Matrix& height, SfsContext* context)
+{
+    if (!validSize(image.rows, image.cols) || !validParameters(params))
+        return SFS_INVALID_ARGUMENT;
+
+    return guarded([&]()
+    {
+        if (height.rows != image.rows || height.cols != image.cols)
+            height = Matrix(image.rows, image.cols);
+
+        return reconstructImage(image, params, height.values[0], context);
+    });
+}
+
+int sfsReconstruct(const double* image, int rows, int cols, const sfs_params& params,
+                   double* height, SfsContext* context)
+{
+    if (!validShape(image, rows, cols, height) || !validParameters(params))
+        return SFS_INVALID_ARGUMENT;
+
+    return guarded([&]()
+    {
+        Matrix grey(rows, cols);
+        std::memcpy(grey.values[0], image, size_t(rows) * cols * sizeof(double));
+
+        return reconstructImage(grey, params, height, context);
+    });
+}
+
+int sfsReconstruct(const uint8_t* image, int rows, int cols, double scale,
+                   const sfs_params& params, double* height, SfsContext* context)
+{
+    return reconstructSamples(image, rows, cols, scale, params, height, context);
+}
+
+int sfsReconstruct(const uint16_t* image, int rows, int cols, double scale,
+                   const sfs_params& params, double* height, SfsContext* context)
+{
+    return reconstructSamples(image, rows, cols, scale, params, height, context);
+}
+
+// ====================== C interface ======================
+
+int sfs_reconstruct(const double* image, int rows, int cols,
+                    const sfs_params* params, double* height)
+{
+    if (!params)
+        return SFS_INVALID_ARGUMENT;
+    return sfsReconstruct(image, rows, cols, *params, height);
+}
+
+int sfs_reconstruct_u8(const uint8_t* image, int rows, int cols, double scale,
+                       const sfs_params* params, double* height)
+{
+    if (!params)
+        return SFS_INVALID_ARGUMENT;
+    return sfsReconstruct(image, rows, cols, scale, *params, height);
+}
+
+int sfs_reconstruct_u16(const uint16_t* image, int rows, int cols, double scale,
+                        const sfs_params* params, double* height)
+{
+    if (!params)
+        return SFS_INVALID_ARGUMENT;
+    return sfsReconstruct(image, rows, cols, scale, *params, height);
+}
@@ -0,0 +1,85 @@
+#include "../include/trial_pool.hpp"
+
+TrialPool::TrialPool(int size) : arenas(new FrameArena[size > 0 ? size : 1])
+{
+    for (int t = 1; t <= size; t++)
+        threads.emplace_back([this, t]() { serve(t); });
+}
+
+TrialPool::~TrialPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    start.notify_all();
+
+    for (std::thread& thread : threads)
+        thread.join();
+}
+
+void TrialPool::run(const std::function<void(int)>& task, int count)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        current = &task;
+        current_count = count;
+        pending = count - 1;
+        failure = nullptr;
+        round++;
+    }
+    start.notify_all();
+
+    std::exception_ptr own_failure;
+    try
+    {
+        task(0);
+    }
+    catch (...)
+    {
+        own_failure = std::current_exception();
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this]() { return pending == 0; });
+
+    if (own_failure)
+        std::rethrow_exception(own_failure);
+    if (failure)
+        std::rethrow_exception(failure);
+}
+
+void TrialPool::serve(int t)
+{
+    long seen = 0;
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while (true)
+    {
+        start.wait(lock, [&]() { return stopping || round != seen; });
+        if (stopping)
+            return;
+        seen = round;
+
+        // Threads beyond the round's tasks sit it out
+        if (t >= current_count)
+            continue;
+
+        lock.unlock();
+        std::exception_ptr thrown;
+        try
+        {
+            (*current)(t);
+        }
+        catch (...)
+        {
+            thrown = std::current_exception();
+        }
+        lock.lock();
+
+        if (thrown && !failure)
+            failure = thrown;
+        if (--pending == 0)
+            done.notify_one();
+    }
+}